@@ -0,0 +1,73 @@
+#ifndef CORPUS_INDEX_H_123
+#define CORPUS_INDEX_H_123
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Type definitios */
+
+/*
+ * Layout of a corpus index file. The header is followed by the normalized text of every file (each one ends with a
+ * newline and the whole text with a 0 byte) and then by the offset tables. Every offset is a 64 bit position inside
+ * the text, the files table holds two of them per file: where its text starts and where its name starts in the names
+ * section. All the sections start at multiples of 8 so the tables can be used straight from the mapped file.
+ */
+typedef struct tCorpusHeader
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t textOff, textSize;
+    uint64_t filesOff, nfiles;
+    uint64_t namesOff, namesSize;
+    uint64_t linesOff, nlines;
+    uint64_t sentencesOff, nsentences;
+    uint64_t wordsOff, nwords;
+} tCorpusHeader;
+
+/*
+ * A corpus index mapped in memory. Opening it costs the same whatever the size of the corpus, the pages are only
+ * read when a passage is taken from them.
+ */
+typedef struct tCorpus
+{
+    void *map;
+    size_t mapSize;
+    const tCorpusHeader *hdr;
+    const char *text;
+    const uint64_t *files;
+    const char *names;
+    const uint64_t *lines;
+    const uint64_t *sentences;
+    const uint64_t *words;
+} tCorpus;
+
+/* Defines */
+
+#define CORPUS_MAGIC "2FCORPUS"
+#define CORPUS_VERSION 1
+
+/*Function prototypes */
+
+/*
+ * Indexes every regular file under dir and writes the index to out. Errors are printed to stderr. Returns 0 on
+ * success or -1 on error.
+ */
+int corpusBuild(const char *dir, const char *out);
+
+/*
+ * Maps the index file path. Returns 0 on success or -1 if the file can't be mapped or isn't a valid index.
+ */
+int corpusOpen(tCorpus *c, const char *path);
+
+/*
+ * Returns a newly allocated passage of about length characters. It starts at the sentence chosen by r and ends at
+ * the end of a word. Returns NULL when there is no passage, or the sentence lies outside the text of a damaged index.
+ */
+char *corpusPassage(const tCorpus *c, int length, uint64_t r);
+
+/*
+ * Unmaps the index.
+ */
+void corpusClose(tCorpus *c);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef DRILL_GEN_H_123
+#define DRILL_GEN_H_123
+
+#include <key_stats.h>
+
+/* Type definitios */
+
+/*
+ * Generator of drills made of words of a corpus, the words are picked with a probability that grows with the
+ * average latency and the mistakes of the bigrams they contain. Words are sampled with an alias table, so every
+ * word costs O(1) whatever the size of the corpus.
+ */
+typedef struct tDrill
+{
+    /* The words point inside corpus, which must outlive the generator. */
+    const char *corpus;
+    int nwords;
+    int *wordOff;
+    int *wordLen;
+    double *weight;
+    /* Alias table built from weight. */
+    double *prob;
+    int *alias;
+    /* Totals of every bigram, indexed by KEY_PAIR(prev, cur). */
+    unsigned long long *count;
+    unsigned long long *errors;
+    unsigned long long *sum;
+    /* Average latency assumed for bigrams that were never typed. */
+    double prior;
+    /* The words that contain each bigram, pairWords[pairStart[p]] up to pairWords[pairStart[p + 1]]. */
+    int *pairStart;
+    int *pairWords;
+    unsigned long long rng;
+} tDrill;
+
+/*Function prototypes */
+
+/*
+ * Splits corpus in words and indexes their bigrams. Returns 0 on success or -1 if the corpus has no words.
+ */
+int drillInit(tDrill *d, const char *corpus);
+
+/*
+ * Replaces the bigram totals with the n entries of stats and rebuilds the alias table.
+ */
+void drillSetStats(tDrill *d, const tKeyStat *stats, int n);
+
+/*
+ * Adds the n entries of delta to the bigram totals. Only the words that contain one of these bigrams get a new weight,
+ * then the alias table is rebuilt.
+ */
+void drillUpdate(tDrill *d, const tKeyStat *delta, int n);
+
+/*
+ * Returns a newly allocated drill of at least length characters (words separated by spaces).
+ */
+char *drillGenerate(tDrill *d, int length);
+
+/*
+ * Frees the memory held by the generator.
+ */
+void drillFree(tDrill *d);
+
+#endif
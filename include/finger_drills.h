@@ -0,0 +1,88 @@
+#ifndef FINGER_DRILLS_H_123
+#define FINGER_DRILLS_H_123
+
+#include <stdint.h>
+
+/* Defines */
+
+/* Most drills a file can define, keys a drill can have and bytes of its name. */
+#define FINGER_DRILLS_MAX 64
+#define FINGER_DRILL_KEYS 32
+#define FINGER_DRILL_NAME 16
+
+/* The drills file in the XDG config directory, it's optional. */
+#define FINGER_DRILLS_DIR "2fingers"
+#define FINGER_DRILLS_FILE "drills.conf"
+
+/*
+ * Drills of the auto test when there is no drills file: the keys typed by the ring and pinky fingers of a qwerty
+ * keyboard, in pairs.
+ */
+#define FINGER_DRILLS_DEFAULT "qw\nas\nzx\nop\nl;\n./\n"
+
+/* 1 if the key c (getKey() values included) is in the set s, c is evaluated more than once. */
+#define KEY_SET_HAS(s, c) ((unsigned)(c) < 256 && ((s)->bits[(unsigned)(c) >> 6] >> ((unsigned)(c) & 63) & 1))
+
+/* Type definitios */
+
+/*
+ * Set of bytes, to check a key in a single lookup.
+ */
+typedef struct tKeySet
+{
+    uint64_t bits[4];
+} tKeySet;
+
+/*
+ * A drill of the auto test: its keys are typed in a loop, starting from any of them. It's compiled into a transition
+ * table, so the key that follows any key of the drill is a single lookup.
+ */
+typedef struct tFingerDrill
+{
+    /* The results of the drill are saved with this name. */
+    char name[FINGER_DRILL_NAME];
+    char keys[FINGER_DRILL_KEYS + 1];
+    int len;
+    /* The key that comes after each key of the drill, 0 for the keys that aren't in it. */
+    unsigned char next[256];
+} tFingerDrill;
+
+/*
+ * Every drill of the auto test, and which of them each key starts.
+ */
+typedef struct tFingerDrills
+{
+    int n;
+    tFingerDrill drill[FINGER_DRILLS_MAX];
+    /* 1 + the index of the drill that a key starts, 0 for the keys that start none. */
+    unsigned char start[256];
+} tFingerDrills;
+
+/*Function prototypes */
+
+/*
+ * Fills set with the bytes of keys.
+ */
+void keySetInit(tKeySet *set, const char *keys);
+
+/*
+ * Compiles the drills of text. Each line is the name of a drill and its keys, separated by spaces, or only the keys
+ * when they are the name too. Empty lines and the ones starting with # are skipped. The keys are printable ASCII
+ * characters (letters are lowercased, like the test reads them), a key can only be once in a drill and in a single
+ * drill, as it's the key that tells which drill starts. Errors are printed to stderr with the line they are in, name
+ * is the file shown. Returns 0 or 1 on error.
+ */
+int fingerDrillsCompile(tFingerDrills *d, const char *text, const char *name);
+
+/*
+ * Compiles the drills of the file path. With a NULL path it's FINGER_DRILLS_FILE in the XDG config directory, and
+ * FINGER_DRILLS_DEFAULT if that file doesn't exist. Returns 0 or 1 on error.
+ */
+int fingerDrillsLoad(tFingerDrills *d, const char *path);
+
+/*
+ * Returns the drill that the key c starts, or NULL.
+ */
+tFingerDrill *fingerDrillFind(tFingerDrills *d, int c);
+
+#endif
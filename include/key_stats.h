@@ -0,0 +1,67 @@
+#ifndef KEY_STATS_H_123
+#define KEY_STATS_H_123
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Type definitios */
+
+/*
+ * Aggregated latency of a single bigram, pair is the previous character shifted 8 bits to the left plus the current
+ * one. A key on its own is stored in the same format with the previous character set to 0.
+ */
+typedef struct tKeyStat
+{
+    unsigned short pair;
+    unsigned int count;
+    unsigned int errors;
+    unsigned long long sum;
+} tKeyStat;
+
+/*
+ * Inter-key latencies recorded during a single test. Every bigram of the test is added as it is typed, and the log is
+ * aggregated by keyLogCompact when the test is over, so the database only has to update each distinct bigram once.
+ */
+typedef struct tKeyLog
+{
+    tKeyStat *ev;
+    int n;
+    int cap;
+} tKeyLog;
+
+/* Defines */
+
+#define KEYLOG_INIT {NULL, 0, 0}
+#define KEY_PAIR(prev, cur) ((unsigned short)(((unsigned char)(prev) << 8) | (unsigned char)(cur)))
+
+/*Function prototypes */
+
+/*
+ * Records that cur was typed correctly us microseconds after prev. Returns 0 or -1 when there is no memory left for
+ * the record, which is then lost.
+ */
+int keyLogKey(tKeyLog *log, char prev, char cur, long long us);
+
+/*
+ * Records a wrong key where cur was expected after prev. Returns 0 or -1 like keyLogKey().
+ */
+int keyLogMiss(tKeyLog *log, char prev, char cur);
+
+/*
+ * Merges the records of the same bigram and adds the totals of every key. Afterwards ev holds one entry per distinct
+ * key and bigram sorted by pair, so the keys come first. Returns 0 or -1 when there is no memory left to add the
+ * totals of the keys, the bigrams are merged anyway.
+ */
+int keyLogCompact(tKeyLog *log);
+
+/*
+ * Forgets every record, the memory is kept for the next test.
+ */
+void keyLogReset(tKeyLog *log);
+
+/*
+ * Frees the memory held by log.
+ */
+void keyLogFree(tKeyLog *log);
+
+#endif
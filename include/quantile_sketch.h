@@ -0,0 +1,102 @@
+#ifndef QUANTILE_SKETCH_H_123
+#define QUANTILE_SKETCH_H_123
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Defines */
+
+/*
+ * Compression of the digests: about this many centroids are kept after a merge, and the quantiles near the ends are
+ * the most accurate. The rank error of a quantile is around 1 / DIGEST_COMPRESSION at the median.
+ */
+#define DIGEST_COMPRESSION 100
+/* Centroids a digest holds, the values added after a merge are buffered in the room left until it's full. */
+#define DIGEST_CAP 256
+
+/* First bytes of a serialized digest, the version is in the last one. */
+#define DIGEST_MAGIC 0x31474454u
+
+/* Type definitios */
+
+/*
+ * Mean of the values it stands for and how many they are.
+ */
+typedef struct tCentroid
+{
+    double mean;
+    double weight;
+} tCentroid;
+
+/*
+ * A merging t-digest: a sketch of the distribution of every value added, in constant space, that can be merged with
+ * other digests. The centroids are small near the ends of the distribution, so the extreme percentiles stay
+ * accurate. A zeroed tDigest is an empty digest.
+ */
+typedef struct tDigest
+{
+    int n;
+    /* The centroids are sorted and merged, nothing was added since. */
+    int merged;
+    double total;
+    double min;
+    double max;
+    tCentroid c[DIGEST_CAP];
+} tDigest;
+
+/*
+ * A digest in a blob: this header, then its n centroids. Numbers are in the byte order of the machine.
+ */
+typedef struct tDigestHeader
+{
+    uint32_t magic;
+    uint32_t n;
+    double total;
+    double min;
+    double max;
+} tDigestHeader;
+
+/*Function prototypes */
+
+/*
+ * Empties d.
+ */
+void digestInit(tDigest *d);
+
+/*
+ * Adds the value x with weight w, which is 1 for a single value.
+ */
+void digestAdd(tDigest *d, double x, double w);
+
+/*
+ * Adds every value of the digest from to d.
+ */
+void digestMerge(tDigest *d, const tDigest *from);
+
+/*
+ * Merges the centroids of the values added since the last merge, so d takes the least room.
+ */
+void digestCompress(tDigest *d);
+
+/*
+ * Returns the value under which a fraction q (0 to 1) of the values are, interpolated between the centroids. An empty
+ * digest returns 0.
+ */
+double digestQuantile(tDigest *d, double q);
+
+/*
+ * Returns the bytes d takes in a blob.
+ */
+size_t digestSize(const tDigest *d);
+
+/*
+ * Writes d to blob, which has digestSize(d) bytes.
+ */
+void digestWrite(const tDigest *d, void *blob);
+
+/*
+ * Reads the size bytes of blob written by digestWrite() into d. Returns 0 or -1 if they aren't a digest.
+ */
+int digestRead(tDigest *d, const void *blob, size_t size);
+
+#endif
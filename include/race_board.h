@@ -0,0 +1,87 @@
+#ifndef RACE_BOARD_H_123
+#define RACE_BOARD_H_123
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Defines */
+
+/* Racers that fit on a board, each one takes a row of the status area. */
+#define RACE_SLOTS 4
+#define RACE_NAME_SIZE 16
+#define RACE_MAGIC 0x32465243u
+/* Times raceRead() copies a slot that is being written before it gives up until the next redraw. */
+#define RACE_READ_TRIES 64
+
+/* Type definitios */
+
+/*
+ * What a racer publishes after every key.
+ */
+typedef struct tRaceState
+{
+    char player[RACE_NAME_SIZE];
+    int pos;
+    int len;
+    int mistakes;
+    long cpm;
+} tRaceState;
+
+/*
+ * A slot has a single writer, the process whose pid owns it, and is read with a sequence lock: seq is odd while the
+ * state is being written, so a reader that sees it odd or changed after copying the state just tries again. Readers
+ * never write to the slot, so they can't delay the writer. Each slot takes its own cache line.
+ */
+typedef struct tRaceSlot
+{
+    _Atomic unsigned int seq;
+    _Atomic int pid;
+    tRaceState state;
+} __attribute__((aligned(64))) tRaceSlot;
+
+/*
+ * The board lives in a POSIX shared memory object named after the race, every process racing maps it.
+ */
+typedef struct tRaceBoard
+{
+    _Atomic unsigned int magic;
+    tRaceSlot slot[RACE_SLOTS];
+} tRaceBoard;
+
+/*
+ * A process taking part in a race.
+ */
+typedef struct tRace
+{
+    tRaceBoard *board;
+    int slot;
+    /* Same for every racer of the race, so a passage can be chosen from it. */
+    uint64_t seed;
+    char shmName[64];
+} tRace;
+
+/*Function prototypes */
+
+/*
+ * Maps the board of the race and takes a free slot for player, slots of processes that are gone are free too.
+ * Returns 0 on success or -1 if the board can't be mapped or it's full.
+ */
+int raceJoin(tRace *r, const char *race, const char *player);
+
+/*
+ * Publishes the progress of this process. It never waits for anything.
+ */
+void racePublish(tRace *r, int pos, int len, int mistakes, long cpm);
+
+/*
+ * Copies the state of slot to *out. Returns 1 if the slot has a racer, 0 if it's free, its racer died while
+ * publishing or it couldn't be read after RACE_READ_TRIES tries.
+ */
+int raceRead(tRace *r, int slot, tRaceState *out);
+
+/*
+ * Frees the slot of this process and unmaps the board. The board is removed once nobody is left.
+ */
+void raceLeave(tRace *r);
+
+#endif
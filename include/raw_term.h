@@ -12,6 +12,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <utf8.h>
 
 /* Type definitios */
 
@@ -32,17 +33,31 @@ enum termKey
 /*
  * This is the basic row struct, it holds all the characters of the row
  * the render pointer is basically chars with translated tabs into spaces.
+ * A row is a single allocation: render is chars itself when the row has no tabs, which is nearly always, and it
+ * follows chars in the same block otherwise.
+ * size and rsize count bytes, width counts the columns render takes on the terminal. When ascii is set every byte
+ * takes one column, otherwise the row holds UTF-8 text that has to be walked by grapheme clusters.
  */
 typedef struct tRow
 {
     int idx;
     int size;
     int rsize;
+    int width;
+    int ascii;
     char *chars;
     char *render;
-    unsigned char *hl;
 } tRow;
 
+/*
+ * A row given to insertRows(), the len bytes at s.
+ */
+typedef struct tRowText
+{
+    const char *s;
+    size_t len;
+} tRowText;
+
 /*
  * This struct contains all the information related to our current terminal session.
  * the orig_termios parameter is used to restore the parameters of the terminal before
@@ -57,6 +72,8 @@ typedef struct termAttributes
     int coloff;
     int screenrows;
     int screencols;
+    /* Rows of the status area over the status bar, they belong to the status thread like the bar. */
+    int boardrows;
     int numrows;
     tRow *row;
     char *statusmsg;
@@ -64,21 +81,12 @@ typedef struct termAttributes
     struct termios orig_termios;
 } termAttributes;
 
-/*
- * This buffer is used to store in a big string all the characters of the
- * visible rows which will at once be written to stdout, to update the screen
- */
-typedef struct tBuf
-{
-    char *b;
-    int len;
-} tBuf;
-
 /* Defines */
 
 #define TAB_STOP 4
-#define ABUF_INIT {NULL, 0}
 #define CTRL_KEY(k) ((k) & 0x1f)
+/* Rows dumpRows() keeps on the stack, it allocates room for more. */
+#define DUMP_ROWS 64
 
 /*Function prototypes */
 
@@ -112,6 +120,12 @@ int getKey(void);
  */
 void insertChar(int c);
 
+/*
+ * Inserts the len bytes of s, a whole UTF-8 sequence, in the position pointed by the cy and cx parameters of the
+ * termAttributes struct.
+ */
+void insertText(const char *s, int len);
+
 /*
  * Updates the position of the cursor when pressing arrow keys
  */
@@ -128,9 +142,16 @@ void delRow(int line);
  */
 void delRows(int line);
 
+/*
+ * Inserts the n rows of rows in position line, in that order. They are spliced in with a single lock, resize and
+ * move of the rows after them, whatever their number.
+ */
+void insertRows(int line, const tRowText *rows, int n);
+
 /*
  * Inserts up to maxLine lines in position line. This function always updates the cursor
- * to be at the next to last row.
+ * to be at the next to last row. Lines longer than the screen are split by columns, never inside a UTF-8 sequence.
+ * Every line is inserted with a single call to insertRows().
  */
 int dumpRows(char *string, int maxLines, int line);
 
@@ -139,10 +160,33 @@ int dumpRows(char *string, int maxLines, int line);
  */
 void pexit(const char *s);
 
+/*
+ * Appends a row with the len bytes of s to T. Unlike the functions above it works on any terminal state, not the one
+ * of this process, and it doesn't lock anything.
+ */
+void termAppendRow(termAttributes *T, const char *s, size_t len);
+
+/*
+ * Frees every row of T, the row array is kept for the next rows.
+ */
+void termFreeRows(termAttributes *T);
+
+/*
+ * Same as setAppMessage() for the terminal state T.
+ */
+void termSetMessage(termAttributes *T, const char *fmt, ...);
+
 /*
  * Retrun the address of the terminal attributes.
  */
 termAttributes * getTermAttributes(void);
+/*
+ * Makes the status thread give rows rows over the status bar to draw, which calls draw for each of them about ten
+ * times per second. draw writes the row-th line in buf, in at most size columns, buf has 64 more bytes for SGR
+ * colors. It has to be called before the first call to initShellAttributes().
+ */
+void setStatusBoard(int rows, void (*draw)(int row, char *buf, int size));
+
 /*
  * Api to print some message in the lst line of the terminal.
  */
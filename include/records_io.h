@@ -0,0 +1,58 @@
+#ifndef RECORDS_IO_H_123
+#define RECORDS_IO_H_123
+
+#include <stdio.h>
+
+/* Defines */
+
+/* Rows inserted by each transaction of an import. */
+#define RECORDS_BATCH 100000
+/* Size of the stdio buffers of the exported and imported files. */
+#define RECORDS_BUFFER (1 << 20)
+/* KiB of page cache used by an import, it's only taken as the indexes grow. */
+#define RECORDS_CACHE_KIB 262144
+
+/* Type definitios */
+
+/*
+ * Text formats of the results. A CSV file starts with a header naming its columns, NDJSON has one object per line.
+ */
+enum recordsFormat
+{
+    RECORDS_CSV,
+    RECORDS_NDJSON
+};
+
+/*Function prototypes */
+
+/*
+ * Returns the format named by name ("csv" or "ndjson"), or the one matching the extension of path when name is NULL
+ * (CSV for anything but .ndjson, .jsonl and .json). Returns -1 for an unknown name.
+ */
+int recordsFormat(const char *path, const char *name);
+
+/*
+ * Writes every row of Records to path ("-" is the standard output) in format, oldest first. The rows are streamed
+ * straight from the database, so the memory used doesn't depend on their number. Returns 0 or 1 on error.
+ */
+int recordsExport(const char *path, int format);
+
+/*
+ * Adds the results of path ("-" is the standard input) to Records, the format is found from the first character.
+ * Columns are matched by name, so they can come in any order and the ones Records doesn't have (Id, CPM) are
+ * skipped. StartedAt may be missing, the results with one are added to the daily and weekly totals too. Rows are
+ * inserted with a single prepared statement in bulk transactions of RECORDS_BATCH rows (see begin_bulk_insert()), the
+ * totals and the sketches are updated once per batch. It stops at the first malformed row, the batches before it stay
+ * in the database. Returns 0 or 1 on error.
+ */
+int recordsImport(const char *path);
+
+/*
+ * Adds the results of the databases of paths, n of them, to Records. They are attached one at a time and read in
+ * batches of RECORDS_BATCH rows, each in its own transaction, so the memory used doesn't depend on their number or
+ * size. A result whose content (test, length, mistakes, time and start) is already in Records is skipped, so merging
+ * a database again adds nothing. The databases merged are only read. Returns 0 or 1 on error.
+ */
+int recordsMerge(char **paths, int n);
+
+#endif
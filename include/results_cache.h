@@ -0,0 +1,97 @@
+#ifndef RESULTS_CACHE_H_123
+#define RESULTS_CACHE_H_123
+
+#include <sqlite3.h>
+
+/* Defines */
+
+/* Rows the columns of a group start with. */
+#define CACHE_GROUP_INIT 16
+
+/* Type definitios */
+
+/*
+ * The results of a test that are compared with each other, sorted by time (then length and id, like the index of
+ * Records). Each field is a column of its own, so walking the times of a group only reads times.
+ */
+typedef struct tResultCols
+{
+    /* Length every result of the group has, 0 for a test whose results of any length are compared. */
+    int key;
+    int n;
+    int cap;
+    double *time;
+    int *length;
+    int *mistakes;
+    sqlite3_int64 *id;
+} tResultCols;
+
+/*
+ * Running totals of the results of a test with the same length, enough for every average the menus show.
+ */
+typedef struct tLengthStats
+{
+    int length;
+    long count;
+    double sumTime;
+    long long sumMistakes;
+} tLengthStats;
+
+/*
+ * Everything cached about a test name.
+ */
+typedef struct tTestCache
+{
+    char *name;
+    tResultCols *groups;
+    int ngroups;
+    /* Sorted by length. */
+    tLengthStats *lens;
+    int nlens;
+} tTestCache;
+
+/*Function prototypes */
+
+/*
+ * Starts loading the results of the database at path in a thread of its own, through a read only connection.
+ * groupKey(name, length) gives the key of the group a result belongs to. Until the load is over cacheReady()
+ * returns 0 and the results added are kept aside, they go into the cache once it's loaded.
+ */
+void cacheStart(const char *path, int (*groupKey)(const char *name, int length));
+
+/*
+ * Returns 1 once the cache holds every result.
+ */
+int cacheReady(void);
+
+/*
+ * Adds a result that was just saved. It does nothing unless cacheStart() was called.
+ */
+void cacheAdd(sqlite3_int64 id, const char *name, int length, int mistakes, double time);
+
+/*
+ * Returns the test name, or NULL if it has no results. Only valid when the cache is ready.
+ */
+const tTestCache *cacheTest(const char *name);
+
+/*
+ * Returns the group with key of test t, or NULL if there is none.
+ */
+const tResultCols *cacheGroup(const tTestCache *t, int key);
+
+/*
+ * Sets *list to every test sorted by name and returns their number.
+ */
+int cacheTests(const tTestCache * const **list);
+
+/*
+ * Counts the results of g faster than time in *better and the slower ones in *slower, with two binary searches.
+ */
+void cacheRank(const tResultCols *g, double time, int *better, int *slower);
+
+/*
+ * Returns the result added last, the pointers are NULL if nothing was added since the start.
+ */
+void cacheLast(const tTestCache **t, const tResultCols **g, double *time);
+
+#endif
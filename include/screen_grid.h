@@ -0,0 +1,115 @@
+#ifndef SCREEN_GRID_H_123
+#define SCREEN_GRID_H_123
+
+#include <raw_term.h>
+#include <sys/uio.h>
+
+/* Type definitios */
+
+/*
+ * A single character cell as it is shown on the terminal. ch holds the UTF-8 bytes of one code point packed from the
+ * lowest byte up, so a plain ASCII cell is just the character. A cluster of several code points is stored in the
+ * cluster table of the grid and its cell is CELL_CLUSTER(index), the second column of a wide character is CELL_WIDE.
+ * The attr byte keeps the foreground SGR color code in the lower 7 bits (0 means the default color) and the reverse
+ * video flag in the highest bit.
+ */
+typedef struct tCell
+{
+    unsigned int ch;
+    unsigned char attr;
+} tCell;
+
+/*
+ * The bytes of a grapheme cluster that doesn't fit in a cell.
+ */
+typedef struct tCluster
+{
+    unsigned char len;
+    char bytes[UTF8_CLUSTER_MAX];
+} tCluster;
+
+/*
+ * The front grid keeps what the terminal currently shows, so every frame only sends the cells that changed.
+ * flen holds for each row the index after the last non blank cell of the front grid, this way a row that got
+ * shorter can be cleared with a single erase sequence.
+ */
+typedef struct tGrid
+{
+    int rows;
+    int cols;
+    tCell *front;
+    tCell *back;
+    int *flen;
+    /* Cursor position and visibility after the last frame, -1 when unknown. */
+    int lastcy, lastcx;
+    /* Start of the render bytes each row of the back grid was copied from, NULL if it wasn't copied from a row. */
+    const char **src;
+    /*
+     * The frame is a list of pieces handed to writev, they point straight to the render buffers of the rows, to
+     * constant strings or to the escape sequences formatted in esc.
+     */
+    struct iovec *iov;
+    int iovcnt;
+    int iovcap;
+    char *esc;
+    int esclen;
+    int esccap;
+    /* Where the frame is written and how many bytes were written so far. */
+    int fd;
+    int written;
+    /* Hash table of the clusters referenced by the cells, it's only allocated once a row has one. */
+    tCluster *clusters;
+    int nclusters;
+    int clustercap;
+    /*
+     * When nonblock is set a frame the fd can't take at once isn't waited for, the rest of it is kept in pend until
+     * gridDrain writes it. No frame is built while there is something pending.
+     */
+    int nonblock;
+    char *pend;
+    int pendlen;
+    int pendcap;
+} tGrid;
+
+/* Defines */
+
+#define GRID_INIT {0, 0, NULL, NULL, NULL, -1, -1, NULL, NULL, 0, 0, NULL, 0, 0, -1, 0, NULL, 0, 0, 0, NULL, 0, 0}
+#define CELL_REVERSE 0x80
+/* The lowest byte of these cells can't start a UTF-8 sequence, so they never match a character. */
+#define CELL_WIDE 0xffu
+#define CELL_CLUSTER(i) (((unsigned int)(i) << 8) | 0xfeu)
+#define CELL_IS_CLUSTER(ch) (((ch) & 0xffu) == 0xfeu)
+
+/*Function prototypes */
+
+/*
+ * Resizes the grid to rows x cols cells. The front grid is invalidated so the next frame repaints every cell.
+ */
+void gridResize(tGrid *g, int rows, int cols);
+
+/*
+ * Marks every cell of the front grid as unknown, this is needed after something else has written over the screen.
+ */
+void gridInvalidate(tGrid *g);
+
+/*
+ * Frees the memory held by the grid.
+ */
+void gridFree(tGrid *g);
+
+/*
+ * Builds the next frame of T (visible rows plus the app message) and writes to fd only the cells that differ from the
+ * previous frame. The characters of plain ASCII rows are not copied, the frame is submitted with writev pointing to
+ * the render buffers, so T must not change until this function returns. The frame is wrapped in the synchronized
+ * update mode (DEC 2026), terminals that don't know this mode just ignore it. Returns the number of bytes written or
+ * -1 on error. If the grid is non blocking and the previous frame is still pending nothing is built and it returns 0.
+ */
+int gridRender(tGrid *g, termAttributes *T, int fd);
+
+/*
+ * Writes to fd as much of the pending frame of a non blocking grid as it takes. Returns the number of bytes still
+ * pending or -1 on error.
+ */
+int gridDrain(tGrid *g, int fd);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef SPEED_METER_H_123
+#define SPEED_METER_H_123
+
+/* Type definitios */
+
+/*
+ * Number of recent key intervals used for the instantaneous speed.
+ */
+#define SPEED_WINDOW 16
+
+/*
+ * Streaming speed engine, it is fed the timestamp (in microseconds) of every correct key and keeps in a ring the
+ * intervals between the last SPEED_WINDOW keys. Every update and every query takes constant time and only integer
+ * arithmetic. All the speeds are returned in hundredths of characters per minute.
+ */
+typedef struct tSpeed
+{
+    long long first;
+    long long last;
+    long long ring[SPEED_WINDOW];
+    /* Sum of the intervals currently in the ring. */
+    long long windowSum;
+    int head;
+    int filled;
+    long keys;
+    /* Exponentially weighted moving average of the interval, in microseconds scaled by 256. */
+    long long ewma;
+} tSpeed;
+
+/*Function prototypes */
+
+/*
+ * Returns the current time of a monotonic clock in microseconds.
+ */
+long long speedNow(void);
+
+/*
+ * Resets the engine, ts is the timestamp of the first key of the test.
+ */
+void speedStart(tSpeed *s, long long ts);
+
+/*
+ * Adds the key pressed at timestamp ts.
+ */
+void speedKey(tSpeed *s, long long ts);
+
+/*
+ * CPM of the last SPEED_WINDOW keys.
+ */
+long speedInstant(const tSpeed *s);
+
+/*
+ * CPM since the first key of the test.
+ */
+long speedCumulative(const tSpeed *s);
+
+/*
+ * CPM derived from the moving average of the intervals, it reacts faster than the cumulative speed but is smoother
+ * than the instantaneous one.
+ */
+long speedEwma(const tSpeed *s);
+
+/*
+ * Microseconds between the first and the last key.
+ */
+long long speedElapsed(const tSpeed *s);
+
+/*
+ * Returns the SGR color code of the speed band that cpm (in hundredths) belongs to.
+ */
+int speedColor(long cpm);
+
+#endif
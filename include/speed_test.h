@@ -5,10 +5,27 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include <speed_test_sqlite.h>
+#include <typing_core.h>
+#include <drill_gen.h>
+#include <corpus_index.h>
+#include <race_board.h>
+#include <finger_drills.h>
+#include <text_norm.h>
 #include <raw_term.h>
+#include <startup_trace.h>
 #include <stdio.h>
 #include <memory.h>
 
+/* Defines */
+
+/* Length of the text every session of the benchmark types. */
+#define BENCH_TEXT_LENGTH 4096
+
+/* Characters typed between two results of the marathon when no number is given. */
+#define MARATHON_CHECKPOINT 1000
+/* A key that comes this long (in microseconds) after the previous one ends a break, which isn't timed. */
+#define MARATHON_BREAK_US 5000000
+
 /*
  * Prints the main menu message and handles the user's decisions.
  */
@@ -19,15 +36,44 @@ int goto_Menu(void);
  */
 void setAttributes(int testLength, char *testName, char *fileBuffer);
 
+/*
+ * Makes the custom test take a random passage of the test length from the corpus c every time it starts, instead of
+ * the text of a single file.
+ */
+void setCorpus(tCorpus *c);
+
+/*
+ * Makes the auto test use the drills d, which must outlive the program. It has to be called before the menu is
+ * shown and before the database is opened.
+ */
+void setDrills(tFingerDrills *d);
+
+/*
+ * Makes the marathon save a result every checkpoint characters instead of MARATHON_CHECKPOINT.
+ */
+void setMarathon(int checkpoint);
+
+/*
+ * Makes the custom test publish its progress to the race r, and shows every racer of r over the status bar. With a
+ * corpus every racer types the passage chosen by the race. It has to be called before the menu is shown.
+ */
+void setRace(tRace *r);
+
 /*
  * Converts a string to a positive int. If the input isn't a number the function returns -1.
  */
 int convertInput(char* input);
 
 /*
- * Reads filename, if the file exists the function allocates memory equal to its size and returns that pointer. If the
- * file doesn't exists the function returns 0.
+ * Reads filename, if the file exists the function allocates memory equal to its size and returns that pointer to
+ * its normalized text. If the file doesn't exists the function returns 0.
  */
 char *fileToBuffer(char *filename);
 
+/*
+ * Feeds events keys to the typing engine as fast as it takes them and prints how many it handled per second. There
+ * is no terminal nor database involved, only the engine. Returns 0.
+ */
+int benchCore(long events);
+
 #endif
@@ -4,12 +4,75 @@
 
 #include <sqlite3.h>
 #include <raw_term.h>
+#include <key_stats.h>
+#include <finger_drills.h>
 #include <stdio.h>
 
+/* Defines */
+
+/* The database is DB_FILE in the DB_DIR folder of the XDG data directory, unless another path is given. */
+#define DB_DIR "2fingers"
+#define DB_FILE "test.db"
+/* Milliseconds to wait for another instance that is writing. */
+#define DB_BUSY_TIMEOUT 5000
+/* Bytes of the database read through a memory map, and KiB of page cache. */
+#define DB_MMAP_SIZE 268435456
+#define DB_CACHE_KIB 16384
+
+#define DB_STR_(x) #x
+#define DB_STR(x) DB_STR_(x)
+
+/* Most rows a page of the result browser can have, and the largest top-N it shows. */
+#define PAGE_MAX 256
+#define PAGE_LIMIT_MAX 100000000
+
+/* Most periods the trend of a test shows. */
+#define TREND_MAX 512
+
+/* Type definitios */
+
+/*
+ * Directions a page of results can be read in.
+ */
+enum pageDir
+{
+    PAGE_FIRST,
+    PAGE_NEXT,
+    PAGE_PREV
+};
+
+/*
+ * Where a row of the result browser is in the index of the results.
+ */
+typedef struct tPageKey
+{
+    double time;
+    int length;
+    sqlite3_int64 id;
+} tPageKey;
+
+/*
+ * A page of the result browser. It only remembers the keys of its first and last rows, the next page is read from
+ * the index right after them.
+ */
+typedef struct tPager
+{
+    char fingers[64];
+    /* 0 when the results of every length are browsed. */
+    int length;
+    int size;
+    int limit;
+    /* Position of the first row of the page among all the results, and rows in the page. */
+    int offset;
+    int count;
+    tPageKey first, last;
+} tPager;
+
 /*Function definitions */
 
 /*
- * Gets the results returned by the sqlite query and prints them.
+ * Gets the rows returned by the sqlite query, they are added to the table the first argument points to and printed
+ * all at once when the query is done.
  */
 int callback(void *, int, char **, char **);
 
@@ -19,16 +82,89 @@ int callback(void *, int, char **, char **);
 int init_sqlite_db(void);
 
 /*
- * Queries the database to get the tests with test name *fingers, and length Length
- * you can order up to no_of_results results.
+ * Makes init_sqlite_db() open path instead of the default database. It has to be called before it.
  */
-int get_nmin(char *Fingers, int Length, char no_of_results);
+void set_db_path(const char *path);
 
 /*
- * Inserts a result to the sqlite database.
+ * The results of the drills of d are compared only with the ones of the same length, like the auto test does.
+ * Without it those are the default 2finger tests. It has to be called before the database is opened.
+ */
+void set_finger_tests(const tFingerDrills *d);
+
+/*
+ * Opens the database like init_sqlite_db(), but in a thread of its own so the program doesn't wait for it, then
+ * starts loading every result in memory in the background. Once they are loaded the result browser, the averages,
+ * the ranks and the percentiles are computed from memory, and every insert() updates them. Before that the queries
+ * go to the database as usual. Every function of this file waits for the database if it isn't open yet. Only the
+ * thread that called it may use them.
+ */
+void start_sqlite_db(void);
+
+/*
+ * Returns the connection opened by init_sqlite_db() or start_sqlite_db().
+ */
+sqlite3 *get_db(void);
+
+/*
+ * Sets p up to browse the results of the test Fingers, fastest first, size rows at a time (at most PAGE_MAX). Only
+ * the limit fastest ones are shown, all of them when limit is 0. Length only counts for the default 2finger tests,
+ * like in the other queries.
+ */
+void open_pager(tPager *p, char *Fingers, int Length, int size, int limit);
+
+/*
+ * Shows the first page of p (dir PAGE_FIRST), or the one after or before the page shown, in the rows from line on.
+ * Only that page is fetched and kept in the rows, when there is nothing after or before it the page stays.
+ */
+int page_results(tPager *p, int dir, int line);
+
+/*
+ * Ranks the result saved by the last call to insert() among the results of its test: *rank is 1 for the fastest
+ * time, *slower counts the results with a longer time and *total all of them.
+ */
+int get_last_rank(int *rank, int *slower, int *total);
+
+/*
+ * Shows how many results the test has, the time under which 50, 90 and 99 percent of them are and the speed as many
+ * of them reach. They are read from the sketches of the test, so they are close but not exact, and they take the same
+ * time whatever the number of results. With an empty Fingers the sketches of every drill of the auto test of
+ * Length are merged.
+ */
+int get_percentiles(char *Fingers, int Length);
+
+/*
+ * Keeps the results of the last days days, the older ones only count in the daily and weekly totals from then on.
+ * They are deleted now and every time the database is opened, 0 keeps every result. Returns the number of results
+ * deleted, or -1 on error.
+ */
+int set_retention(int days);
+
+/*
+ * Draws the CPM of the test Fingers per day, or per week when weekly is set, as a sparkline of at most width
+ * periods (TREND_MAX at most), the last one being the last period the test was taken.
+ */
+int get_trend(char *Fingers, int weekly, int width);
+
+/*
+ * Inserts a result to the sqlite database, with the time it started.
  */
 int insert(char* Fingers, int Length, int Mistakes, float Time);
 
+/*
+ * Starts a transaction to add many results with statements of the caller, like an import does. The daily and weekly
+ * totals and the sketches aren't updated row by row while it lasts, end_bulk_insert() adds the whole batch to them.
+ * Returns 0 or 1 on error, which is printed to stderr.
+ */
+int begin_bulk_insert(void);
+
+/*
+ * Ends the transaction of begin_bulk_insert(): with commit the results added since are kept and added to the totals
+ * and the sketches, otherwise they are rolled back. Returns 0 or 1 on error, the batch is rolled back then and the
+ * error printed to stderr.
+ */
+int end_bulk_insert(int commit);
+
 /*
  * Get the average results for a single test.
  */
@@ -39,4 +175,20 @@ int get_average(char *Fingers, int Length);
  */
 int get_all_averages(char *Fingers);
 
+/*
+ * Adds the latencies recorded in log to the per key and per bigram totals. The log is compacted first, so every
+ * distinct key and bigram is written once.
+ */
+int save_key_stats(tKeyLog *log);
+
+/*
+ * Loads the totals of every key and bigram, *stats points to a newly allocated array of *n entries.
+ */
+int load_key_stats(tKeyStat **stats, int *n);
+
+/*
+ * Shows the no_of_results keys and bigrams with the highest average latency.
+ */
+int get_slowest_keys(int no_of_results);
+
 #endif
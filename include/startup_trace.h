@@ -0,0 +1,24 @@
+#ifndef STARTUP_TRACE_H_123
+#define STARTUP_TRACE_H_123
+
+/* Defines */
+
+/* Most phases a startup trace records, the ones after it are dropped. */
+#define TRACE_MAX 32
+
+/*Function prototypes */
+
+/*
+ * Starts the trace: every traceMark() from now on is recorded, and they are printed to stderr when the program
+ * exits, once the terminal is restored.
+ */
+void traceStart(void);
+
+/*
+ * Records that phase just ended, from any thread. Each phase is shown with the time since traceStart() and since the
+ * previous mark of the same thread, so the phases running in the background are measured on their own. It does
+ * nothing unless the trace was started.
+ */
+void traceMark(const char *phase);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef TEXT_NORM_H_123
+#define TEXT_NORM_H_123
+
+#include <stddef.h>
+
+/* Defines */
+
+/* Size of the blocks of plain ASCII text that are copied at once. */
+#define TEXT_BLOCK 16
+
+/*Function prototypes */
+
+/*
+ * Copies len bytes of src to dst as clean text that can be compared key by key:
+ *  - CRLF and lone CR line endings become LF, and there is at most one blank line in a row.
+ *  - Tabs and no-break spaces become spaces, runs of spaces become one and lines have no leading or trailing spaces.
+ *  - Control characters are dropped and bytes that aren't valid UTF-8 are replaced by '?'.
+ * Blocks of TEXT_BLOCK printable ASCII bytes without runs of spaces are copied with SIMD instructions when they are
+ * available. The output is never longer than the input, so dst may be the same buffer as src. Returns the number of
+ * bytes written to dst.
+ */
+size_t textNormalize(char *dst, const char *src, size_t len);
+
+#endif
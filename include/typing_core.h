@@ -0,0 +1,69 @@
+#ifndef TYPING_CORE_H_123
+#define TYPING_CORE_H_123
+
+#include <speed_meter.h>
+#include <key_stats.h>
+
+/* Type definitios */
+
+/*
+ * What a key did to the session.
+ */
+enum coreResult
+{
+    /* The session hasn't started and the key isn't the first character of the text. */
+    CORE_IGNORED,
+    CORE_MATCH,
+    CORE_MISTAKE,
+    /* The key was right and it was the last character of the text. */
+    CORE_FINISH
+};
+
+/*
+ * A typing test as a state machine. It's fed keys with their timestamps and tells what each one did, it never reads
+ * the terminal, draws or touches the database, so the tests, benchmarks and any other front end share it. The
+ * session doesn't own text nor log.
+ */
+typedef struct tSession
+{
+    const char *text;
+    int len;
+    /* Byte of the text the next key has to match. */
+    int idx;
+    int mistakes;
+    int started;
+    tSpeed speed;
+    /* Latencies of the keys, it can be NULL if they aren't needed. */
+    tKeyLog *log;
+} tSession;
+
+/*Function prototypes */
+
+/*
+ * Prepares s to test the len bytes of text. Every key typed is recorded in log unless it's NULL.
+ */
+void sessionInit(tSession *s, const char *text, int len, tKeyLog *log);
+
+/*
+ * Starts the session over, the keys of the log are forgotten too.
+ */
+void sessionReset(tSession *s);
+
+/*
+ * Goes on with the len bytes of text as if they came right after the text of s: the clock, the mistakes and the log
+ * are kept. text[-1] has to be the last byte of the previous text, it's the first half of the next bigram.
+ */
+void sessionNext(tSession *s, const char *text, int len);
+
+/*
+ * Feeds the n bytes of key, a whole UTF-8 sequence, typed at timestamp now (in microseconds). The clock starts with
+ * the first character of the text, keys before it are ignored. Keys after the session finished are ignored too.
+ */
+int sessionKey(tSession *s, const char *key, int n, long long now);
+
+/*
+ * Returns 1 once the whole text was typed.
+ */
+int sessionDone(const tSession *s);
+
+#endif
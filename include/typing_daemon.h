@@ -0,0 +1,74 @@
+#ifndef TYPING_DAEMON_H_123
+#define TYPING_DAEMON_H_123
+
+#include <raw_term.h>
+#include <screen_grid.h>
+#include <typing_core.h>
+#include <corpus_index.h>
+#include <speed_test_sqlite.h>
+
+/* Defines */
+
+/* Size of the input buffer of a client, a key or an escape sequence never takes more. */
+#define DAEMON_INPUT_SIZE 256
+/* Screen size used until the terminal of the client tells its own. */
+#define DAEMON_ROWS 24
+#define DAEMON_COLS 80
+/* Largest screen size taken from a client, the frames of a bigger one would only fill the socket. */
+#define DAEMON_MAX_SIZE 1000
+/* Lines of the text shown over the line being typed. */
+#define DAEMON_TEXT_ROWS 4
+/* Events taken from epoll at once. */
+#define DAEMON_EVENTS 64
+
+/* Type definitios */
+
+/*
+ * A typist connected to the daemon. Everything the single user program keeps in static variables lives here, so one
+ * process can host any number of them: the terminal state, the cells shown on the terminal and the typing session.
+ */
+typedef struct tClient
+{
+    int fd;
+    int id;
+    termAttributes term;
+    tGrid grid;
+    tSession session;
+    tKeyLog log;
+    /* The text of the test, it's owned by the client when it's a passage of a corpus. */
+    char *text;
+    int ownText;
+    /* Offsets where every screen line of the text starts, the last one is the length of the text. */
+    int *lines;
+    int nlines;
+    int line;
+    int finished;
+    int dirty;
+    /* Bytes received that don't make a whole key or escape sequence yet. */
+    char in[DAEMON_INPUT_SIZE];
+    int inlen;
+} tClient;
+
+/*
+ * A finished test waiting for the database writer.
+ */
+typedef struct tResult
+{
+    int length;
+    int mistakes;
+    float time;
+    tKeyLog log;
+    struct tResult *next;
+} tResult;
+
+/*Function prototypes */
+
+/*
+ * Listens on the Unix domain socket path and serves a typing test to every client that connects, until SIGINT or
+ * SIGTERM. Every client types text, or a passage of length characters of corpus when it isn't NULL, and the results
+ * are saved with the name testName. A single thread runs every session, the results are written to the database by
+ * another one. Returns 0, or -1 if the socket can't be set up.
+ */
+int daemonRun(const char *path, char *testName, char *text, tCorpus *corpus, int length);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef UTF8_H_123
+#define UTF8_H_123
+
+#include <stddef.h>
+
+/* Defines */
+
+/* Longest grapheme cluster kept together, the code points after it start a new cluster. */
+#define UTF8_CLUSTER_MAX 32
+/* Code point given for a byte that isn't part of a valid sequence. */
+#define UTF8_INVALID 0xffffffffu
+
+/*Function prototypes */
+
+/*
+ * Makes the C library use UTF-8 for character widths, if the locale of the environment doesn't already.
+ */
+void utf8Init(void);
+
+/*
+ * Returns the length of the sequence that the byte lead starts, 1 for ASCII and for bytes that can't start one.
+ */
+int utf8Length(unsigned char lead);
+
+/*
+ * Returns the length of the valid UTF-8 sequence that starts at s, or 0 if it isn't valid. *cp holds the code point.
+ * Overlong forms, surrogates and code points after U+10FFFF aren't valid.
+ */
+int utf8Decode(const unsigned char *s, size_t left, unsigned int *cp);
+
+/*
+ * Returns the number of columns code point cp takes on the terminal: 0, 1 or 2. The widths of the basic plane are
+ * cached after the first lookup.
+ */
+int utf8Width(unsigned int cp);
+
+/*
+ * Returns the length in bytes of the grapheme cluster at s: a code point followed by its combining marks and joined
+ * code points. *width holds the columns it takes (at least 1) and *cp its first code point, UTF8_INVALID for a byte
+ * that isn't valid UTF-8.
+ */
+int utf8Cluster(const char *s, size_t left, int *width, unsigned int *cp);
+
+/*
+ * Returns 1 if the len bytes at s are all ASCII, checking blocks of 16 bytes at once.
+ */
+int utf8IsAscii(const char *s, size_t len);
+
+#endif
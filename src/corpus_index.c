@@ -0,0 +1,610 @@
+#define _GNU_SOURCE
+#include <corpus_index.h>
+#include <text_norm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Size of the chunks used to copy the tables into the index. */
+#define COPY_CHUNK 65536
+/* A passage is extended by at most this many bytes to reach the end of a word. */
+#define MAX_WORD_TAIL 64
+/* Number of files each worker may have ingested ahead of the writer. */
+#define SLOTS_PER_WORKER 2
+
+/* Type definitios */
+
+/*
+ * Growable array of offsets.
+ */
+typedef struct tOffsets
+{
+    uint64_t *v;
+    size_t n;
+    size_t cap;
+} tOffsets;
+
+/*
+ * A file ingested by a worker: its normalized text and the offsets (relative to the start of the file) of its lines,
+ * words and sentences.
+ */
+typedef struct tIngest
+{
+    char *text;
+    size_t len;
+    tOffsets lines;
+    tOffsets words;
+    tOffsets sentences;
+    /* One of the SLOT_ values. */
+    int state;
+    int err;
+} tIngest;
+
+enum slotState
+{
+    SLOT_FREE,
+    SLOT_BUSY,
+    SLOT_DONE
+};
+
+/* Static variables */
+/* Paths of the files found by nftw, nftw has no way to pass them to the caller. */
+static char **paths = NULL;
+static int npaths = 0;
+static int cappaths = 0;
+/* The ingestion pool, file i goes to slot i % nslots. */
+static tIngest *slots = NULL;
+static int nslots = 0;
+/* Next file to give to a worker, and number of files the writer is done with. */
+static int nextFile = 0;
+static int writtenFiles = 0;
+/* Set when the writer gives up, so the workers don't take more files. */
+static int stopIngest = 0;
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolCond = PTHREAD_COND_INITIALIZER;
+
+/* Local functions */
+
+/*
+ * nftw callback that collects the regular files.
+ */
+static int collectFile(const char *path, const struct stat *sb, int type, struct FTW *ftw);
+
+/*
+ * qsort comparator for the collected paths, so the same directory always gives the same index.
+ */
+static int cmpPath(const void *a, const void *b);
+
+/*
+ * Writes the 64 bit offset off to the table f.
+ */
+static int putOffset(FILE *f, uint64_t off);
+
+/*
+ * Appends the contents of the temporary file from to out, and pads out to a multiple of 8 bytes. Returns the offset
+ * where the contents start or -1 on error.
+ */
+static long long appendTable(FILE *out, FILE *from);
+
+/*
+ * Reads the file path and returns its normalized text ending with a newline, *len holds its size.
+ */
+static char *loadNormalized(const char *path, size_t *len);
+
+/*
+ * Appends off to o. Returns 0 on success or -1 if there is no memory.
+ */
+static int addOffset(tOffsets *o, uint64_t off);
+
+/*
+ * Loads and normalizes the file path into job, and finds the offsets of its lines, words and sentences.
+ */
+static void ingestFile(tIngest *job, const char *path);
+
+/*
+ * Thread that takes the next file that has a free slot and ingests it, until every file was taken.
+ */
+static void *ingestWorker(void *arg);
+
+/*
+ * Writes every offset of o moved by base to the table f.
+ */
+static int putOffsets(FILE *f, const tOffsets *o, uint64_t base);
+
+static int collectFile(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+    if (type != FTW_F)
+        return 0;
+
+    if (npaths == cappaths)
+    {
+        int cap = cappaths ? cappaths * 2 : 64;
+        char **new = (char **)realloc(paths, sizeof(char *) * cap);
+
+        if (new == 0)
+            return -1;
+
+        paths = new;
+        cappaths = cap;
+    }
+
+    paths[npaths] = strdup(path);
+    if (paths[npaths] == NULL)
+        return -1;
+
+    npaths++;
+
+    return 0;
+}
+
+static int cmpPath(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int putOffset(FILE *f, uint64_t off)
+{
+    return fwrite(&off, sizeof(off), 1, f) == 1 ? 0 : -1;
+}
+
+static long long appendTable(FILE *out, FILE *from)
+{
+    char buf[COPY_CHUNK];
+    size_t n;
+    long long start = ftello(out);
+
+    rewind(from);
+    while ((n = fread(buf, 1, sizeof(buf), from)) > 0)
+        if (fwrite(buf, 1, n, out) != n)
+            return -1;
+
+    /* Every section starts aligned so its offsets can be read in place. */
+    while (ftello(out) % 8)
+        if (fputc(0, out) == EOF)
+            return -1;
+
+    return ferror(from) ? -1 : start;
+}
+
+static char *loadNormalized(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    struct stat sb;
+
+    if (f == NULL)
+        return NULL;
+
+    if (fstat(fileno(f), &sb) == -1)
+    {
+        fclose(f);
+        return NULL;
+    }
+
+    char *text = (char *)malloc(sb.st_size + 1);
+    if (text == NULL)
+    {
+        fclose(f);
+        return NULL;
+    }
+
+    size_t size = fread(text, 1, sb.st_size, f);
+    fclose(f);
+
+    *len = textNormalize(text, text, size);
+
+    /* Every file ends with a newline, so the next one starts on its own line. */
+    if (*len == 0 || text[*len - 1] != '\n')
+        text[(*len)++] = '\n';
+
+    return text;
+}
+
+static int addOffset(tOffsets *o, uint64_t off)
+{
+    if (o->n == o->cap)
+    {
+        size_t cap = o->cap ? o->cap * 2 : 1024;
+        uint64_t *new = (uint64_t *)realloc(o->v, sizeof(uint64_t) * cap);
+
+        if (new == NULL)
+            return -1;
+
+        o->v = new;
+        o->cap = cap;
+    }
+
+    o->v[o->n++] = off;
+
+    return 0;
+}
+
+static int putOffsets(FILE *f, const tOffsets *o, uint64_t base)
+{
+    for (size_t i = 0; i < o->n; i++)
+        if (putOffset(f, base + o->v[i]))
+            return -1;
+
+    return 0;
+}
+
+static void ingestFile(tIngest *job, const char *path)
+{
+    job->lines.n = job->words.n = job->sentences.n = 0;
+    job->err = 0;
+    job->text = loadNormalized(path, &job->len);
+
+    if (job->text == NULL)
+    {
+        job->err = errno ? errno : EIO;
+        return;
+    }
+
+    /* A sentence starts with a file, after a blank line and after a word that ends with . ! or ? */
+    int newSentence = 1;
+    for (size_t j = 0; j < job->len; j++)
+    {
+        char c = job->text[j];
+        char prev = j ? job->text[j - 1] : '\n';
+
+        if (prev == '\n' && addOffset(&job->lines, j))
+            goto NO_MEMORY;
+
+        /* The text is normalized, so spaces and newlines are the only whitespace left. */
+        if (c == ' ' || c == '\n')
+        {
+            if (prev == '.' || prev == '!' || prev == '?' || (c == '\n' && prev == '\n'))
+                newSentence = 1;
+            continue;
+        }
+
+        if (prev == ' ' || prev == '\n')
+        {
+            if (addOffset(&job->words, j))
+                goto NO_MEMORY;
+
+            if (newSentence)
+            {
+                if (addOffset(&job->sentences, j))
+                    goto NO_MEMORY;
+                newSentence = 0;
+            }
+        }
+    }
+
+    return;
+
+NO_MEMORY:
+    free(job->text);
+    job->text = NULL;
+    job->err = ENOMEM;
+}
+
+static void *ingestWorker(void *arg)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&poolMutex);
+
+        /* Don't get more than nslots files ahead of the writer, so memory stays bounded. */
+        while (!stopIngest && nextFile < npaths && nextFile - writtenFiles >= nslots)
+            pthread_cond_wait(&poolCond, &poolMutex);
+
+        if (stopIngest || nextFile >= npaths)
+        {
+            pthread_mutex_unlock(&poolMutex);
+            return NULL;
+        }
+
+        int i = nextFile++;
+        tIngest *job = &slots[i % nslots];
+        job->state = SLOT_BUSY;
+        pthread_mutex_unlock(&poolMutex);
+
+        ingestFile(job, paths[i]);
+
+        pthread_mutex_lock(&poolMutex);
+        job->state = SLOT_DONE;
+        pthread_cond_broadcast(&poolCond);
+        pthread_mutex_unlock(&poolMutex);
+    }
+}
+
+int corpusBuild(const char *dir, const char *out)
+{
+    tCorpusHeader hdr;
+    FILE *o, *files, *names, *lines, *sentences, *words;
+    int rc = -1;
+    uint64_t pos = 0;
+    pthread_t *workers = NULL;
+    int started = 0;
+
+    if (nftw(dir, collectFile, 32, FTW_PHYS) == -1)
+    {
+        fprintf(stderr, "Can't read the directory %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    qsort(paths, npaths, sizeof(char *), cmpPath);
+
+    o = fopen(out, "wb");
+    files = tmpfile();
+    names = tmpfile();
+    lines = tmpfile();
+    sentences = tmpfile();
+    words = tmpfile();
+
+    if (!o || !files || !names || !lines || !sentences || !words)
+    {
+        fprintf(stderr, "Can't create %s: %s\n", out, strerror(errno));
+        goto END;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CORPUS_MAGIC, sizeof(hdr.magic));
+    hdr.version = CORPUS_VERSION;
+    hdr.textOff = sizeof(hdr);
+
+    /* The header is written again at the end, when every section is known. */
+    if (fwrite(&hdr, sizeof(hdr), 1, o) != 1)
+        goto WRITE_ERROR;
+
+    /* Workers normalize and index the files in parallel, this thread writes them in order. */
+    long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    int nworkers = nproc > 0 ? nproc : 1;
+    if (nworkers > npaths)
+        nworkers = npaths ? npaths : 1;
+
+    nslots = nworkers * SLOTS_PER_WORKER;
+    slots = (tIngest *)calloc(nslots, sizeof(tIngest));
+    workers = (pthread_t *)calloc(nworkers, sizeof(pthread_t));
+
+    if (slots == NULL || workers == NULL)
+    {
+        fprintf(stderr, "Not enough memory to index %s\n", dir);
+        goto END;
+    }
+
+    nextFile = writtenFiles = 0;
+    stopIngest = 0;
+    for (started = 0; started < nworkers; started++)
+        if (pthread_create(&workers[started], NULL, ingestWorker, NULL))
+            break;
+
+    if (started == 0)
+    {
+        fprintf(stderr, "Can't start the ingestion threads\n");
+        goto END;
+    }
+
+    for (int i = 0; i < npaths; i++)
+    {
+        tIngest *job = &slots[i % nslots];
+
+        pthread_mutex_lock(&poolMutex);
+        while (job->state != SLOT_DONE)
+            pthread_cond_wait(&poolCond, &poolMutex);
+        pthread_mutex_unlock(&poolMutex);
+
+        if (job->text == NULL)
+        {
+            fprintf(stderr, "Skipping %s: %s\n", paths[i], strerror(job->err));
+        }
+        else
+        {
+            const char *name = paths[i] + strlen(dir);
+            while (*name == '/')
+                name++;
+
+            if (putOffset(files, pos) || putOffset(files, hdr.namesSize) ||
+                    fwrite(name, 1, strlen(name) + 1, names) != strlen(name) + 1 ||
+                    putOffsets(lines, &job->lines, pos) || putOffsets(words, &job->words, pos) ||
+                    putOffsets(sentences, &job->sentences, pos) || fwrite(job->text, 1, job->len, o) != job->len)
+                goto WRITE_ERROR;
+
+            hdr.nfiles++;
+            hdr.namesSize += strlen(name) + 1;
+            hdr.nlines += job->lines.n;
+            hdr.nwords += job->words.n;
+            hdr.nsentences += job->sentences.n;
+            pos += job->len;
+
+            free(job->text);
+            job->text = NULL;
+        }
+
+        pthread_mutex_lock(&poolMutex);
+        job->state = SLOT_FREE;
+        writtenFiles++;
+        pthread_cond_broadcast(&poolCond);
+        pthread_mutex_unlock(&poolMutex);
+    }
+
+    hdr.textSize = pos;
+    /* The text ends with a 0, so a passage at its end is still a valid string. */
+    if (fputc(0, o) == EOF)
+        goto WRITE_ERROR;
+
+    long long off;
+    if ((off = appendTable(o, names)) < 0)
+        goto WRITE_ERROR;
+    hdr.namesOff = off;
+
+    if ((off = appendTable(o, files)) < 0)
+        goto WRITE_ERROR;
+    hdr.filesOff = off;
+
+    if ((off = appendTable(o, lines)) < 0)
+        goto WRITE_ERROR;
+    hdr.linesOff = off;
+
+    if ((off = appendTable(o, sentences)) < 0)
+        goto WRITE_ERROR;
+    hdr.sentencesOff = off;
+
+    if ((off = appendTable(o, words)) < 0)
+        goto WRITE_ERROR;
+    hdr.wordsOff = off;
+
+    if (fseeko(o, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, o) != 1)
+        goto WRITE_ERROR;
+
+    printf("Indexed %llu files with %d threads: %llu bytes, %llu lines, %llu sentences, %llu words\n",
+            (unsigned long long)hdr.nfiles, started, (unsigned long long)hdr.textSize, (unsigned long long)hdr.nlines,
+            (unsigned long long)hdr.nsentences, (unsigned long long)hdr.nwords);
+    rc = 0;
+    goto END;
+
+WRITE_ERROR:
+    fprintf(stderr, "Can't write %s: %s\n", out, strerror(errno));
+
+END:
+    /* After an error the writer stops, so the workers are told there is nothing left to take. */
+    pthread_mutex_lock(&poolMutex);
+    stopIngest = 1;
+    pthread_cond_broadcast(&poolCond);
+    pthread_mutex_unlock(&poolMutex);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    for (int i = 0; i < nslots; i++)
+    {
+        free(slots[i].text);
+        free(slots[i].lines.v);
+        free(slots[i].words.v);
+        free(slots[i].sentences.v);
+    }
+    free(slots);
+    free(workers);
+    slots = NULL;
+    nslots = 0;
+
+    if (o && fclose(o) && rc == 0)
+    {
+        fprintf(stderr, "Can't write %s: %s\n", out, strerror(errno));
+        rc = -1;
+    }
+
+    if (files)
+        fclose(files);
+    if (names)
+        fclose(names);
+    if (lines)
+        fclose(lines);
+    if (sentences)
+        fclose(sentences);
+    if (words)
+        fclose(words);
+
+    for (int i = 0; i < npaths; i++)
+        free(paths[i]);
+    free(paths);
+    paths = NULL;
+    npaths = cappaths = 0;
+
+    return rc;
+}
+
+int corpusOpen(tCorpus *c, const char *path)
+{
+    struct stat sb;
+    int fd = open(path, O_RDONLY);
+
+    memset(c, 0, sizeof(*c));
+
+    if (fd == -1)
+        return -1;
+
+    if (fstat(fd, &sb) == -1 || (size_t)sb.st_size < sizeof(tCorpusHeader))
+    {
+        close(fd);
+        return -1;
+    }
+
+    c->map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (c->map == MAP_FAILED)
+    {
+        c->map = NULL;
+        return -1;
+    }
+
+    c->mapSize = sb.st_size;
+    c->hdr = (const tCorpusHeader *)c->map;
+
+    const tCorpusHeader *h = c->hdr;
+    uint64_t size = c->mapSize;
+
+    /* Check that every section lies inside the file before trusting the offsets. */
+    if (memcmp(h->magic, CORPUS_MAGIC, sizeof(h->magic)) || h->version != CORPUS_VERSION ||
+            h->textOff > size || h->textSize >= size - h->textOff ||
+            ((char *)c->map)[h->textOff + h->textSize] != 0 ||
+            h->namesOff > size || h->namesSize > size - h->namesOff ||
+            h->filesOff > size || h->nfiles > (size - h->filesOff) / 16 ||
+            h->linesOff > size || h->nlines > (size - h->linesOff) / 8 ||
+            h->sentencesOff > size || h->nsentences > (size - h->sentencesOff) / 8 ||
+            h->wordsOff > size || h->nwords > (size - h->wordsOff) / 8)
+    {
+        corpusClose(c);
+        return -1;
+    }
+
+    c->text = (const char *)c->map + h->textOff;
+    c->names = (const char *)c->map + h->namesOff;
+    c->files = (const uint64_t *)((const char *)c->map + h->filesOff);
+    c->lines = (const uint64_t *)((const char *)c->map + h->linesOff);
+    c->sentences = (const uint64_t *)((const char *)c->map + h->sentencesOff);
+    c->words = (const uint64_t *)((const char *)c->map + h->wordsOff);
+
+    return 0;
+}
+
+char *corpusPassage(const tCorpus *c, int length, uint64_t r)
+{
+    if (c->hdr->nsentences == 0 || length <= 0)
+        return NULL;
+
+    uint64_t start = c->sentences[r % c->hdr->nsentences];
+
+    /* The tables aren't read when the index is opened, a damaged one can point past the text. */
+    if (start >= c->hdr->textSize)
+        return NULL;
+
+    uint64_t end = start + length;
+
+    if (end > c->hdr->textSize)
+        end = c->hdr->textSize;
+
+    /* Finish the last word, and drop the whitespace after it. */
+    for (int i = 0; end < c->hdr->textSize && i < MAX_WORD_TAIL; i++, end++)
+        if (c->text[end] == ' ' || c->text[end] == '\n' || c->text[end] == '\t')
+            break;
+
+    while (end > start && (c->text[end - 1] == ' ' || c->text[end - 1] == '\n' || c->text[end - 1] == '\t'))
+        end--;
+
+    char *passage = (char *)malloc(end - start + 1);
+    if (passage == NULL)
+        return NULL;
+
+    memcpy(passage, &c->text[start], end - start);
+    passage[end - start] = '\0';
+
+    return passage;
+}
+
+void corpusClose(tCorpus *c)
+{
+    if (c->map)
+        munmap(c->map, c->mapSize);
+
+    memset(c, 0, sizeof(*c));
+}
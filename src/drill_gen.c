@@ -0,0 +1,319 @@
+#include <drill_gen.h>
+#include <raw_term.h>
+
+/* Number of bigrams that can be stored in a pair. */
+#define PAIRS 65536
+/* Longer words are left out of the drills. */
+#define MAX_WORD 32
+/* Weight of the prior in the average latency of a bigram, so a single slow key press doesn't dominate. */
+#define PRIOR_KEYS 2
+/* Latency in microseconds assumed for every bigram when nothing was typed yet. */
+#define DEFAULT_PRIOR 150000.0
+
+/* Local functions */
+
+/*
+ * Returns the next number of the xorshift64* generator.
+ */
+static unsigned long long drillRand(tDrill *d);
+
+/*
+ * Returns the score of a bigram, its average latency smoothed with the prior and increased by its mistake rate.
+ */
+static double pairScore(tDrill *d, unsigned short pair);
+
+/*
+ * Recalculates the weight of the word i from the scores of its bigrams.
+ */
+static void wordWeight(tDrill *d, int i);
+
+/*
+ * Builds the alias table from the weights of the words with Vose's method.
+ */
+static void buildAlias(tDrill *d);
+
+/*
+ * Returns the bigram number j of the word i, the first and the last bigrams include the spaces around the word.
+ */
+static unsigned short wordPair(tDrill *d, int i, int j);
+
+static unsigned long long drillRand(tDrill *d)
+{
+    d->rng ^= d->rng >> 12;
+    d->rng ^= d->rng << 25;
+    d->rng ^= d->rng >> 27;
+
+    return d->rng * 2685821657736338717ULL;
+}
+
+static unsigned short wordPair(tDrill *d, int i, int j)
+{
+    const char *w = &d->corpus[d->wordOff[i]];
+
+    if (j == 0)
+        return KEY_PAIR(' ', w[0]);
+
+    if (j == d->wordLen[i])
+        return KEY_PAIR(w[j - 1], ' ');
+
+    return KEY_PAIR(w[j - 1], w[j]);
+}
+
+static double pairScore(tDrill *d, unsigned short pair)
+{
+    double mean = (d->sum[pair] + d->prior * PRIOR_KEYS) / (d->count[pair] + PRIOR_KEYS);
+    double missRate = (double)d->errors[pair] / (d->count[pair] + d->errors[pair] + 1);
+
+    return mean * (1 + 3 * missRate);
+}
+
+static void wordWeight(tDrill *d, int i)
+{
+    double total = 0;
+
+    for (int j = 0; j <= d->wordLen[i]; j++)
+        total += pairScore(d, wordPair(d, i, j));
+
+    /* Squaring the average makes the slow words stand out more. */
+    total /= d->wordLen[i] + 1;
+    d->weight[i] = total * total;
+}
+
+static void buildAlias(tDrill *d)
+{
+    int n = d->nwords;
+    double total = 0;
+    int *small = (int *)malloc(sizeof(int) * n);
+    int *large = (int *)malloc(sizeof(int) * n);
+    int ns = 0, nl = 0;
+
+    if (small == 0 || large == 0)
+        pexit("buildAlias");
+
+    for (int i = 0; i < n; i++)
+        total += d->weight[i];
+
+    for (int i = 0; i < n; i++)
+    {
+        d->prob[i] = total > 0 ? d->weight[i] * n / total : 1;
+        d->alias[i] = i;
+
+        if (d->prob[i] < 1)
+            small[ns++] = i;
+        else
+            large[nl++] = i;
+    }
+
+    while (ns && nl)
+    {
+        int s = small[--ns];
+        int l = large[nl - 1];
+
+        d->alias[s] = l;
+        d->prob[l] -= 1 - d->prob[s];
+
+        if (d->prob[l] < 1)
+        {
+            nl--;
+            small[ns++] = l;
+        }
+    }
+
+    /* Whatever is left is 1 up to rounding errors. */
+    while (nl)
+        d->prob[large[--nl]] = 1;
+    while (ns)
+        d->prob[small[--ns]] = 1;
+
+    free(small);
+    free(large);
+}
+
+int drillInit(tDrill *d, const char *corpus)
+{
+    int n = 0;
+    int i = 0;
+
+    memset(d, 0, sizeof(*d));
+    d->corpus = corpus;
+    d->prior = DEFAULT_PRIOR;
+    d->rng = (unsigned long long)time(NULL) * 0x9E3779B97F4A7C15ULL | 1;
+
+    /* First count the words so every array is allocated once. */
+    for (int pass = 0; pass < 2; pass++)
+    {
+        n = 0;
+        i = 0;
+        while (corpus[i])
+        {
+            while (corpus[i] && (unsigned char)corpus[i] <= ' ')
+                i++;
+
+            int start = i;
+            int clean = 1;
+            while (corpus[i] && (unsigned char)corpus[i] > ' ')
+                if (corpus[i++] == 127)
+                    clean = 0;
+
+            if (i > start && i - start <= MAX_WORD && clean)
+            {
+                if (pass)
+                {
+                    d->wordOff[n] = start;
+                    d->wordLen[n] = i - start;
+                }
+                n++;
+            }
+        }
+
+        if (n == 0)
+            return -1;
+
+        if (pass == 0)
+        {
+            d->wordOff = (int *)malloc(sizeof(int) * n);
+            d->wordLen = (int *)malloc(sizeof(int) * n);
+            d->weight = (double *)malloc(sizeof(double) * n);
+            d->prob = (double *)malloc(sizeof(double) * n);
+            d->alias = (int *)malloc(sizeof(int) * n);
+
+            if (!d->wordOff || !d->wordLen || !d->weight || !d->prob || !d->alias)
+                pexit("drillInit");
+        }
+    }
+    d->nwords = n;
+
+    d->count = (unsigned long long *)calloc(PAIRS, sizeof(unsigned long long));
+    d->errors = (unsigned long long *)calloc(PAIRS, sizeof(unsigned long long));
+    d->sum = (unsigned long long *)calloc(PAIRS, sizeof(unsigned long long));
+    d->pairStart = (int *)calloc(PAIRS + 1, sizeof(int));
+
+    if (!d->count || !d->errors || !d->sum || !d->pairStart)
+        pexit("drillInit");
+
+    /* Inverted index from every bigram to the words that contain it. */
+    int total = 0;
+    for (i = 0; i < n; i++)
+        for (int j = 0; j <= d->wordLen[i]; j++)
+        {
+            d->pairStart[wordPair(d, i, j) + 1]++;
+            total++;
+        }
+
+    for (int p = 0; p < PAIRS; p++)
+        d->pairStart[p + 1] += d->pairStart[p];
+
+    d->pairWords = (int *)malloc(sizeof(int) * total);
+    int *fill = (int *)malloc(sizeof(int) * PAIRS);
+
+    if (!d->pairWords || !fill)
+        pexit("drillInit");
+
+    memcpy(fill, d->pairStart, sizeof(int) * PAIRS);
+    for (i = 0; i < n; i++)
+        for (int j = 0; j <= d->wordLen[i]; j++)
+            d->pairWords[fill[wordPair(d, i, j)]++] = i;
+
+    free(fill);
+
+    for (i = 0; i < n; i++)
+        wordWeight(d, i);
+
+    buildAlias(d);
+
+    return 0;
+}
+
+void drillSetStats(tDrill *d, const tKeyStat *stats, int n)
+{
+    unsigned long long count = 0, sum = 0;
+
+    memset(d->count, 0, sizeof(unsigned long long) * PAIRS);
+    memset(d->errors, 0, sizeof(unsigned long long) * PAIRS);
+    memset(d->sum, 0, sizeof(unsigned long long) * PAIRS);
+
+    for (int i = 0; i < n; i++)
+    {
+        /* Single keys aren't bigrams. */
+        if (stats[i].pair < 256)
+            continue;
+
+        d->count[stats[i].pair] = stats[i].count;
+        d->errors[stats[i].pair] = stats[i].errors;
+        d->sum[stats[i].pair] = stats[i].sum;
+        count += stats[i].count;
+        sum += stats[i].sum;
+    }
+
+    /* Unknown bigrams are assumed to be as fast as the average one. */
+    d->prior = count ? (double)sum / count : DEFAULT_PRIOR;
+
+    for (int i = 0; i < d->nwords; i++)
+        wordWeight(d, i);
+
+    buildAlias(d);
+}
+
+void drillUpdate(tDrill *d, const tKeyStat *delta, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        unsigned short p = delta[i].pair;
+
+        if (p < 256)
+            continue;
+
+        d->count[p] += delta[i].count;
+        d->errors[p] += delta[i].errors;
+        d->sum[p] += delta[i].sum;
+
+        for (int w = d->pairStart[p]; w < d->pairStart[p + 1]; w++)
+            wordWeight(d, d->pairWords[w]);
+    }
+
+    buildAlias(d);
+}
+
+char *drillGenerate(tDrill *d, int length)
+{
+    char *text = (char *)malloc(length + MAX_WORD + 2);
+    int len = 0;
+
+    if (text == 0)
+        pexit("drillGenerate");
+
+    while (len < length)
+    {
+        int i = drillRand(d) % d->nwords;
+        /* 53 random bits give the uniform number that decides between the word and its alias. */
+        double u = (drillRand(d) >> 11) * (1.0 / 9007199254740992.0);
+
+        if (u >= d->prob[i])
+            i = d->alias[i];
+
+        if (len)
+            text[len++] = ' ';
+
+        memcpy(&text[len], &d->corpus[d->wordOff[i]], d->wordLen[i]);
+        len += d->wordLen[i];
+    }
+
+    text[len] = '\0';
+
+    return text;
+}
+
+void drillFree(tDrill *d)
+{
+    free(d->wordOff);
+    free(d->wordLen);
+    free(d->weight);
+    free(d->prob);
+    free(d->alias);
+    free(d->count);
+    free(d->errors);
+    free(d->sum);
+    free(d->pairStart);
+    free(d->pairWords);
+    memset(d, 0, sizeof(*d));
+}
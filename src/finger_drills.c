@@ -0,0 +1,208 @@
+#define _GNU_SOURCE // asprintf
+
+#include <finger_drills.h>
+#include <raw_term.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+/* Local functions */
+
+/*
+ * Compiles the drill name with keys into d, errors mention the line of the file name. Returns 0 or 1 on error.
+ */
+static int compileDrill(tFingerDrills *d, const char *name, const char *keys, const char *file, int line);
+
+/*
+ * Reads the whole file path in an allocated string. Returns NULL if it can't be read, errno tells why.
+ */
+static char *readFile(const char *path);
+
+void keySetInit(tKeySet *set, const char *keys)
+{
+    memset(set, 0, sizeof(tKeySet));
+
+    for (; *keys; keys++)
+    {
+        unsigned char c = *keys;
+        set->bits[c >> 6] |= (uint64_t)1 << (c & 63);
+    }
+}
+
+static int compileDrill(tFingerDrills *d, const char *name, const char *keys, const char *file, int line)
+{
+    int len = strlen(keys);
+
+    if (d->n == FINGER_DRILLS_MAX)
+    {
+        fprintf(stderr, "%s:%d: there can't be more than %d drills\n", file, line, FINGER_DRILLS_MAX);
+        return 1;
+    }
+
+    if (strlen(name) >= FINGER_DRILL_NAME)
+    {
+        fprintf(stderr, "%s:%d: the name %s is longer than %d characters\n", file, line, name, FINGER_DRILL_NAME - 1);
+        return 1;
+    }
+
+    if (len < 2 || len > FINGER_DRILL_KEYS)
+    {
+        fprintf(stderr, "%s:%d: a drill has from 2 to %d keys\n", file, line, FINGER_DRILL_KEYS);
+        return 1;
+    }
+
+    tFingerDrill *drill = &d->drill[d->n];
+    memset(drill, 0, sizeof(tFingerDrill));
+    strcpy(drill->name, name);
+    drill->len = len;
+
+    for (int i = 0; i < len; i++)
+    {
+        unsigned char c = tolower((unsigned char)keys[i]);
+
+        if (c <= ' ' || c > '~')
+        {
+            fprintf(stderr, "%s:%d: the keys of a drill are printable ASCII characters\n", file, line);
+            return 1;
+        }
+
+        if (d->start[c])
+        {
+            fprintf(stderr, "%s:%d: the key %c is in %s already\n", file, line, c, d->drill[d->start[c] - 1].name);
+            return 1;
+        }
+
+        drill->keys[i] = c;
+        d->start[c] = d->n + 1;
+    }
+
+    /* The keys are typed in a loop, the last one is followed by the first. */
+    for (int i = 0; i < len; i++)
+        drill->next[(unsigned char)drill->keys[i]] = drill->keys[(i + 1) % len];
+
+    d->n++;
+
+    return 0;
+}
+
+int fingerDrillsCompile(tFingerDrills *d, const char *text, const char *name)
+{
+    char *copy = strdup(text);
+    char *save = NULL;
+    int line = 0;
+    int rc = 0;
+
+    if (copy == NULL)
+        pexit("fingerDrillsCompile");
+
+    memset(d, 0, sizeof(tFingerDrills));
+
+    /* Every line is split, so the empty ones have to be counted by hand. */
+    for (char *s = copy, *end; rc == 0 && s; s = end)
+    {
+        end = strchr(s, '\n');
+        if (end)
+            *end++ = '\0';
+        line++;
+
+        char *first = strtok_r(s, " \t\r", &save);
+        if (first == NULL || first[0] == '#')
+            continue;
+
+        char *second = strtok_r(NULL, " \t\r", &save);
+        if (second && strtok_r(NULL, " \t\r", &save))
+        {
+            fprintf(stderr, "%s:%d: a drill is a name and its keys\n", name, line);
+            rc = 1;
+            break;
+        }
+
+        rc = compileDrill(d, first, second ? second : first, name, line);
+    }
+
+    free(copy);
+
+    if (rc == 0 && d->n == 0)
+    {
+        fprintf(stderr, "%s has no drills\n", name);
+        rc = 1;
+    }
+
+    return rc;
+}
+
+static char *readFile(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+
+    if (f == NULL)
+        return NULL;
+
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    char buf[4096];
+    size_t n;
+
+    if (out == NULL)
+        pexit("readFile");
+
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        fwrite(buf, 1, n, out);
+
+    int failed = ferror(f);
+    fclose(f);
+    fclose(out);
+
+    if (failed)
+    {
+        free(text);
+        errno = EIO;
+        return NULL;
+    }
+
+    return text;
+}
+
+int fingerDrillsLoad(tFingerDrills *d, const char *path)
+{
+    char *file = NULL;
+
+    if (path)
+        file = strdup(path);
+    else
+    {
+        const char *config = getenv("XDG_CONFIG_HOME");
+        const char *home = getenv("HOME");
+
+        if (config && config[0] == '/')
+            asprintf(&file, "%s/" FINGER_DRILLS_DIR "/" FINGER_DRILLS_FILE, config);
+        else if (home && home[0])
+            asprintf(&file, "%s/.config/" FINGER_DRILLS_DIR "/" FINGER_DRILLS_FILE, home);
+    }
+
+    char *text = file ? readFile(file) : NULL;
+
+    /* Only a file that was asked for has to exist. */
+    if (text == NULL && (path || (file && errno != ENOENT)))
+    {
+        fprintf(stderr, "Can't read the drills file %s: %s\n", file, strerror(errno));
+        free(file);
+        return 1;
+    }
+
+    int rc = text ? fingerDrillsCompile(d, text, file) :
+        fingerDrillsCompile(d, FINGER_DRILLS_DEFAULT, "default drills");
+
+    free(text);
+    free(file);
+
+    return rc;
+}
+
+tFingerDrill *fingerDrillFind(tFingerDrills *d, int c)
+{
+    return (unsigned)c < 256 && d->start[c] ? &d->drill[d->start[c] - 1] : NULL;
+}
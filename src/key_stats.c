@@ -0,0 +1,107 @@
+#include <key_stats.h>
+
+/* Local functions */
+
+/*
+ * Append a record to the log, growing it if needed. The library doesn't own the terminal, so running out of memory
+ * isn't fatal here: returns -1 and the record is dropped, 0 otherwise.
+ */
+static int keyLogAppend(tKeyLog *log, unsigned short pair, unsigned int errors, unsigned long long us);
+
+/*
+ * qsort comparator that orders records by pair.
+ */
+static int cmpPair(const void *a, const void *b);
+
+static int keyLogAppend(tKeyLog *log, unsigned short pair, unsigned int errors, unsigned long long us)
+{
+    if (log->n == log->cap)
+    {
+        int cap = log->cap ? log->cap * 2 : 256;
+        tKeyStat *new = (tKeyStat *)realloc(log->ev, sizeof(tKeyStat) * cap);
+
+        if (new == 0)
+            return -1;
+
+        log->ev = new;
+        log->cap = cap;
+    }
+
+    log->ev[log->n].pair = pair;
+    log->ev[log->n].count = !errors;
+    log->ev[log->n].errors = errors;
+    log->ev[log->n].sum = us;
+    log->n++;
+
+    return 0;
+}
+
+int keyLogKey(tKeyLog *log, char prev, char cur, long long us)
+{
+    if (us < 0)
+        us = 0;
+
+    return keyLogAppend(log, KEY_PAIR(prev, cur), 0, us);
+}
+
+int keyLogMiss(tKeyLog *log, char prev, char cur)
+{
+    return keyLogAppend(log, KEY_PAIR(prev, cur), 1, 0);
+}
+
+static int cmpPair(const void *a, const void *b)
+{
+    return (int)((const tKeyStat *)a)->pair - (int)((const tKeyStat *)b)->pair;
+}
+
+int keyLogCompact(tKeyLog *log)
+{
+    int bigrams = log->n;
+    int out = 0;
+    int rc = 0;
+
+    /* Every bigram also counts for the key that was typed. */
+    for (int i = 0; i < bigrams; i++)
+    {
+        tKeyStat ev = log->ev[i];
+
+        if (keyLogAppend(log, ev.pair & 0xff, ev.errors, ev.sum))
+        {
+            rc = -1;
+            break;
+        }
+    }
+
+    qsort(log->ev, log->n, sizeof(tKeyStat), cmpPair);
+
+    for (int i = 0; i < log->n; i++)
+    {
+        if (out && log->ev[out - 1].pair == log->ev[i].pair)
+        {
+            log->ev[out - 1].count += log->ev[i].count;
+            log->ev[out - 1].errors += log->ev[i].errors;
+            log->ev[out - 1].sum += log->ev[i].sum;
+        }
+        else
+        {
+            log->ev[out++] = log->ev[i];
+        }
+    }
+
+    log->n = out;
+
+    return rc;
+}
+
+void keyLogReset(tKeyLog *log)
+{
+    log->n = 0;
+}
+
+void keyLogFree(tKeyLog *log)
+{
+    free(log->ev);
+    log->ev = NULL;
+    log->n = 0;
+    log->cap = 0;
+}
@@ -6,15 +6,246 @@
 #include <speed_test_sqlite.h>
 #include <stdio.h>     // asprintf needs _GNU_SOURCE
 #include <memory.h>
+#include <corpus_index.h>
+#include <typing_daemon.h>
+#include <records_io.h>
+#include <startup_trace.h>
 
 #define DEFAULT_TEST_LENGTH 100
+/* Keys fed to the typing engine by --bench-core when no number is given. */
+#define DEFAULT_BENCH_EVENTS 50000000
 
 int main(int argc, char** argv)
 {
+    /* It times the startup, see startup_trace.h. */
+    if (argc > 1 && strcmp(argv[1], "--startup-trace") == 0)
+    {
+        traceStart();
+        argv[1] = argv[0];
+        argc -= 1;
+        argv += 1;
+    }
+
     /* This function was created to avoid valgrind memory leaks. */
     atexit(freeAll);
+    utf8Init();
+    traceMark("utf8 tables");
+
+    /* The database and the drills file can be chosen before any mode. */
+    const char *drills_path = NULL;
+    while (argc > 2 && (strcmp(argv[1], "--db") == 0 || strcmp(argv[1], "--drills") == 0))
+    {
+        if (strcmp(argv[1], "--db") == 0)
+            set_db_path(argv[2]);
+        else
+            drills_path = argv[2];
+
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench-core") == 0)
+    {
+        int events = argc == 3 ? convertInput(argv[2]) : DEFAULT_BENCH_EVENTS;
+
+        if (argc > 3 || events <= 0)
+        {
+            printf("The correct format is: <prog> --bench-core [<number_of_keys>]\n");
+            return -1;
+        }
+
+        return benchCore(events);
+    }
+    else if (argc > 1 && strcmp(argv[1], "--daemon") == 0)
+    {
+        static tCorpus corpus;
+        char *text = NULL;
+        int testLength = argc == 6 ? convertInput(argv[5]) : DEFAULT_TEST_LENGTH;
+
+        if ((argc != 5 && argc != 6) || testLength <= 0)
+        {
+            printf("The correct format is: <prog> --daemon <socket> <name_of_test> <file_or_index> [<passage_length>]\n");
+            return -1;
+        }
+
+        /* The text can be a corpus index or a single file. */
+        if (corpusOpen(&corpus, argv[4]) && ((text = fileToBuffer(argv[4])) == NULL || text[0] == '\0'))
+        {
+            printf("Can't open the file %s\r\nexiting...\n", argv[4]);
+            return -1;
+        }
+
+        /* Every connection takes a passage, an index of blank files has none to give. */
+        if (text == NULL && corpus.hdr->nsentences == 0)
+        {
+            printf("The corpus index %s has no text\r\nexiting...\n", argv[4]);
+            return -1;
+        }
+
+        if (init_sqlite_db())
+            return -1;
+
+        int rc = daemonRun(argv[2], argv[3], text, text ? NULL : &corpus, testLength);
+        free(text);
+
+        return rc ? -1 : 0;
+    }
+    else if (argc > 1 && strcmp(argv[1], "--race") == 0)
+    {
+        static tCorpus corpus;
+        static tRace race;
+        char *text = NULL;
+        int testLength = argc == 6 ? convertInput(argv[5]) : DEFAULT_TEST_LENGTH;
+
+        if ((argc != 5 && argc != 6) || testLength <= 0)
+        {
+            printf("The correct format is: <prog> --race <race_name> <player_name> <file_or_index> [<passage_length>]\n");
+            return -1;
+        }
+
+        /* Same as the daemon, the text can be a corpus index or a single file. */
+        if (corpusOpen(&corpus, argv[4]) && (text = fileToBuffer(argv[4])) == NULL)
+        {
+            printf("Can't open the file %s\r\nexiting...\n", argv[4]);
+            return -1;
+        }
+
+        if (raceJoin(&race, argv[2], argv[3]))
+        {
+            printf("Can't join the race %s, it may be full\r\nexiting...\n", argv[2]);
+            return -1;
+        }
+
+        if (text == NULL)
+            setCorpus(&corpus);
+
+        setRace(&race);
+        setAttributes(testLength, argv[2], text);
+    }
+    else if (argc > 1 && strcmp(argv[1], "--marathon") == 0)
+    {
+        static tCorpus corpus;
+        char *text = NULL;
+        int checkpoint = argc == 5 ? convertInput(argv[4]) : MARATHON_CHECKPOINT;
+
+        if ((argc != 4 && argc != 5) || checkpoint <= 0)
+        {
+            printf("The correct format is: <prog> --marathon <file_or_index> <name_of_test> [<checkpoint_characters>]\n");
+            return -1;
+        }
+
+        if (corpusOpen(&corpus, argv[2]) && ((text = fileToBuffer(argv[2])) == NULL || text[0] == '\0'))
+        {
+            printf("Can't open the file %s\r\nexiting...\n", argv[2]);
+            return -1;
+        }
+
+        if (text == NULL)
+            setCorpus(&corpus);
+
+        setMarathon(checkpoint);
+        setAttributes(DEFAULT_TEST_LENGTH, argv[3], text);
+    }
+    else if (argc > 1 && strcmp(argv[1], "--export") == 0)
+    {
+        int format = argc > 2 ? recordsFormat(argv[2], argc == 4 ? argv[3] : NULL) : -1;
+
+        if ((argc != 3 && argc != 4) || format == -1)
+        {
+            printf("The correct format is: <prog> --export <file> [csv|ndjson]\n");
+            return -1;
+        }
+
+        if (init_sqlite_db())
+            return -1;
+
+        return recordsExport(argv[2], format) ? -1 : 0;
+    }
+    else if (argc > 1 && strcmp(argv[1], "--import") == 0)
+    {
+        if (argc != 3)
+        {
+            printf("The correct format is: <prog> --import <file>\n");
+            return -1;
+        }
+
+        if (init_sqlite_db())
+            return -1;
+
+        return recordsImport(argv[2]) ? -1 : 0;
+    }
+    else if (argc > 1 && strcmp(argv[1], "--merge") == 0)
+    {
+        if (argc < 3)
+        {
+            printf("The correct format is: <prog> --merge <database>...\n");
+            return -1;
+        }
+
+        if (init_sqlite_db())
+            return -1;
+
+        return recordsMerge(argv + 2, argc - 2) ? -1 : 0;
+    }
+    else if (argc > 1 && strcmp(argv[1], "--retention") == 0)
+    {
+        int days = argc == 3 ? convertInput(argv[2]) : -1;
+
+        if (days < 0)
+        {
+            printf("The correct format is: <prog> --retention <days>\n");
+            return -1;
+        }
+
+        if (init_sqlite_db())
+            return -1;
+
+        int removed = set_retention(days);
+        if (removed < 0)
+        {
+            fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(get_db()));
+            return -1;
+        }
+
+        if (days)
+            printf("Results older than %d days are kept as daily and weekly totals, %d removed\n", days, removed);
+        else
+            printf("Every result is kept\n");
+
+        return 0;
+    }
+    else if (argc > 1 && strcmp(argv[1], "--index") == 0)
+    {
+        if (argc != 4)
+        {
+            printf("The correct format is: <prog> --index <directory> <index_file>\n");
+            return -1;
+        }
+
+        return corpusBuild(argv[2], argv[3]) ? -1 : 0;
+    }
+    else if (argc > 1 && strcmp(argv[1], "--corpus") == 0)
+    {
+        static tCorpus corpus;
+        int testLength = argc == 5 ? convertInput(argv[4]) : DEFAULT_TEST_LENGTH;
+
+        if ((argc != 4 && argc != 5) || testLength <= 0)
+        {
+            printf("The correct format is: <prog> --corpus <index_file> <name_of_test> [<passage_length>]\n");
+            return -1;
+        }
 
-    if (argc > 3)
+        if (corpusOpen(&corpus, argv[2]))
+        {
+            printf("Can't open the corpus index %s\r\nexiting...\n", argv[2]);
+            return -1;
+        }
+
+        setCorpus(&corpus);
+        setAttributes(testLength, argv[3], 0);
+    }
+    else if (argc > 3)
     {
         printf("The program needs at most two arguments, exiting...\n");
         return -1;
@@ -46,7 +277,17 @@ int main(int argc, char** argv)
         setAttributes(DEFAULT_TEST_LENGTH, argv[2], buffer);
     }
 
-    init_sqlite_db();
+    traceMark("arguments read");
+
+    static tFingerDrills drills;
+    if (fingerDrillsLoad(&drills, drills_path))
+        return -1;
+
+    setDrills(&drills);
+    traceMark("drills compiled");
+
+    start_sqlite_db();
+    traceMark("database thread created");
 
     while (goto_Menu());
 
@@ -0,0 +1,199 @@
+#include <quantile_sketch.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Local functions */
+
+/*
+ * Scale function of the digest: a centroid can take the values between q and the q where it grows by 1. It's
+ * steep near 0 and 1, so the centroids at the ends stay small.
+ */
+static double kScale(double q);
+
+/*
+ * Inverse of kScale().
+ */
+static double kInverse(double k);
+
+/*
+ * qsort comparator that orders centroids by mean.
+ */
+static int cmpMean(const void *a, const void *b);
+
+static double kScale(double q)
+{
+    return DIGEST_COMPRESSION / (2 * M_PI) * asin(2 * q - 1);
+}
+
+static double kInverse(double k)
+{
+    if (k >= DIGEST_COMPRESSION / 4.0)
+        return 1;
+
+    return (sin(k * 2 * M_PI / DIGEST_COMPRESSION) + 1) / 2;
+}
+
+static int cmpMean(const void *a, const void *b)
+{
+    double x = ((const tCentroid *)a)->mean, y = ((const tCentroid *)b)->mean;
+
+    return x < y ? -1 : x > y;
+}
+
+void digestInit(tDigest *d)
+{
+    d->n = 0;
+    d->merged = 1;
+    d->total = 0;
+    d->min = 0;
+    d->max = 0;
+}
+
+void digestCompress(tDigest *d)
+{
+    if (d->merged || d->n == 0)
+        return;
+
+    qsort(d->c, d->n, sizeof(tCentroid), cmpMean);
+
+    /* Weight of the centroids before the current one, and the weight the current one can reach. */
+    double before = 0;
+    double limit = d->total * kInverse(kScale(0) + 1);
+    int out = 0;
+
+    for (int i = 1; i < d->n; i++)
+    {
+        double w = d->c[out].weight + d->c[i].weight;
+
+        if (before + w <= limit)
+        {
+            d->c[out].mean += (d->c[i].mean - d->c[out].mean) * d->c[i].weight / w;
+            d->c[out].weight = w;
+        }
+        else
+        {
+            before += d->c[out].weight;
+            limit = d->total * kInverse(kScale(before / d->total) + 1);
+            d->c[++out] = d->c[i];
+        }
+    }
+
+    /* Two neighbours always span more than a unit of the scale, so about DIGEST_COMPRESSION centroids are left. */
+    d->n = out + 1;
+    d->merged = 1;
+}
+
+void digestAdd(tDigest *d, double x, double w)
+{
+    if (w <= 0)
+        return;
+
+    if (d->n == DIGEST_CAP)
+        digestCompress(d);
+
+    if (d->total == 0)
+    {
+        d->min = x;
+        d->max = x;
+    }
+    else if (x < d->min)
+        d->min = x;
+    else if (x > d->max)
+        d->max = x;
+
+    d->c[d->n].mean = x;
+    d->c[d->n].weight = w;
+    d->n++;
+    d->total += w;
+    d->merged = 0;
+}
+
+void digestMerge(tDigest *d, const tDigest *from)
+{
+    if (from->total == 0)
+        return;
+
+    double min = d->total ? fmin(d->min, from->min) : from->min;
+    double max = d->total ? fmax(d->max, from->max) : from->max;
+
+    for (int i = 0; i < from->n; i++)
+        digestAdd(d, from->c[i].mean, from->c[i].weight);
+
+    /* A centroid gives its mean, the extremes are the ones of the values themselves. */
+    d->min = min;
+    d->max = max;
+}
+
+double digestQuantile(tDigest *d, double q)
+{
+    if (d->total == 0)
+        return 0;
+
+    digestCompress(d);
+
+    double t = q * d->total;
+    const tCentroid *first = &d->c[0], *last = &d->c[d->n - 1];
+
+    /* Before the middle of the first centroid and after the middle of the last one, the extremes are interpolated. */
+    if (t < first->weight / 2)
+        return first->weight == 1 ? d->min : d->min + (first->mean - d->min) * t / (first->weight / 2);
+
+    if (t > d->total - last->weight / 2)
+    {
+        if (last->weight == 1)
+            return d->max;
+
+        return last->mean + (d->max - last->mean) * (t - (d->total - last->weight / 2)) / (last->weight / 2);
+    }
+
+    /* Otherwise it's between the middles of two neighbours. */
+    double at = first->weight / 2;
+
+    for (int i = 0; i < d->n - 1; i++)
+    {
+        double gap = (d->c[i].weight + d->c[i + 1].weight) / 2;
+
+        if (t <= at + gap)
+            return d->c[i].mean + (d->c[i + 1].mean - d->c[i].mean) * (t - at) / gap;
+
+        at += gap;
+    }
+
+    return d->max;
+}
+
+size_t digestSize(const tDigest *d)
+{
+    return sizeof(tDigestHeader) + sizeof(tCentroid) * d->n;
+}
+
+void digestWrite(const tDigest *d, void *blob)
+{
+    tDigestHeader h = {DIGEST_MAGIC, d->n, d->total, d->min, d->max};
+
+    memcpy(blob, &h, sizeof(h));
+    memcpy((char *)blob + sizeof(h), d->c, sizeof(tCentroid) * d->n);
+}
+
+int digestRead(tDigest *d, const void *blob, size_t size)
+{
+    tDigestHeader h;
+
+    if (size < sizeof(h))
+        return -1;
+
+    memcpy(&h, blob, sizeof(h));
+
+    if (h.magic != DIGEST_MAGIC || h.n > DIGEST_CAP || size != sizeof(h) + sizeof(tCentroid) * h.n)
+        return -1;
+
+    d->n = h.n;
+    d->merged = 0;
+    d->total = h.total;
+    d->min = h.min;
+    d->max = h.max;
+    memcpy(d->c, (const char *)blob + sizeof(h), sizeof(tCentroid) * h.n);
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include <race_board.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Local functions */
+
+/*
+ * Returns 1 if the process pid is still running.
+ */
+static int raceAlive(int pid);
+
+static int raceAlive(int pid)
+{
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+int raceJoin(tRace *r, const char *race, const char *player)
+{
+    /* FNV-1a of the race name. */
+    r->seed = 14695981039346656037ULL;
+    for (const char *c = race; *c; c++)
+        r->seed = (r->seed ^ (unsigned char)*c) * 1099511628211ULL;
+
+    snprintf(r->shmName, sizeof(r->shmName), "/2fingers-race-%016llx", (unsigned long long)r->seed);
+
+    int fd = shm_open(r->shmName, O_RDWR | O_CREAT, 0600);
+    if (fd == -1)
+        return -1;
+
+    /* A new object is filled with zeros, which is an empty board. */
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (st.st_size < (off_t)sizeof(tRaceBoard) && ftruncate(fd, sizeof(tRaceBoard)) == -1))
+    {
+        close(fd);
+        return -1;
+    }
+
+    r->board = (tRaceBoard *)mmap(NULL, sizeof(tRaceBoard), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (r->board == MAP_FAILED)
+        return -1;
+
+    unsigned int empty = 0;
+    if (!atomic_compare_exchange_strong(&r->board->magic, &empty, RACE_MAGIC) && empty != RACE_MAGIC)
+    {
+        munmap(r->board, sizeof(tRaceBoard));
+        return -1;
+    }
+
+    for (r->slot = 0; r->slot < RACE_SLOTS; r->slot++)
+    {
+        tRaceSlot *s = &r->board->slot[r->slot];
+        int pid = atomic_load(&s->pid);
+
+        if ((pid == 0 || !raceAlive(pid)) && atomic_compare_exchange_strong(&s->pid, &pid, getpid()))
+            break;
+    }
+
+    if (r->slot == RACE_SLOTS)
+    {
+        munmap(r->board, sizeof(tRaceBoard));
+        return -1;
+    }
+
+    /* The sequence may be odd already if the slot was taken from a process that died while writing it. */
+    tRaceSlot *s = &r->board->slot[r->slot];
+    unsigned int seq = atomic_load(&s->seq) | 1;
+
+    atomic_store_explicit(&s->seq, seq, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    memset(&s->state, 0, sizeof(tRaceState));
+    strncpy(s->state.player, player, RACE_NAME_SIZE - 1);
+
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_release);
+
+    return 0;
+}
+
+void racePublish(tRace *r, int pos, int len, int mistakes, long cpm)
+{
+    tRaceSlot *s = &r->board->slot[r->slot];
+    unsigned int seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    s->state.pos = pos;
+    s->state.len = len;
+    s->state.mistakes = mistakes;
+    s->state.cpm = cpm;
+
+    atomic_store_explicit(&s->seq, seq + 2, memory_order_release);
+}
+
+int raceRead(tRace *r, int slot, tRaceState *out)
+{
+    tRaceSlot *s = &r->board->slot[slot];
+    unsigned int before, after;
+
+    for (int tries = 0;; tries++)
+    {
+        int pid = atomic_load_explicit(&s->pid, memory_order_relaxed);
+        if (pid == 0)
+            return 0;
+
+        before = atomic_load_explicit(&s->seq, memory_order_acquire);
+        memcpy(out, &s->state, sizeof(tRaceState));
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&s->seq, memory_order_relaxed);
+
+        if (!(before & 1) && before == after)
+            break;
+
+        /* A racer killed inside racePublish() leaves seq odd for good, its slot is empty. */
+        if (tries == RACE_READ_TRIES || ((before & 1) && slot != r->slot && !raceAlive(pid)))
+            return 0;
+
+        sched_yield();
+    }
+
+    out->player[RACE_NAME_SIZE - 1] = '\0';
+
+    /* The slot of a racer that quit without leaving looks free. */
+    int pid = atomic_load_explicit(&s->pid, memory_order_relaxed);
+    return pid != 0 && (slot == r->slot || raceAlive(pid));
+}
+
+void raceLeave(tRace *r)
+{
+    int others = 0;
+
+    if (r->board == NULL)
+        return;
+
+    atomic_store(&r->board->slot[r->slot].pid, 0);
+
+    for (int i = 0; i < RACE_SLOTS; i++)
+    {
+        int pid = atomic_load(&r->board->slot[i].pid);
+        if (pid && raceAlive(pid))
+            others = 1;
+    }
+
+    munmap(r->board, sizeof(tRaceBoard));
+    r->board = NULL;
+
+    if (!others)
+        shm_unlink(r->shmName);
+}
@@ -1,8 +1,13 @@
 #include <raw_term.h>
+#include <screen_grid.h>
+#include <startup_trace.h>
+#include <sys/ioctl.h>
 
 /* Local variables */
 /* Custom struct to control the terminal */
 static termAttributes E;
+/* Cells currently shown in the terminal, used to write only the differences. */
+static tGrid grid = GRID_INIT;
 /* Thread to refresh periodically the terminal. */
 static pthread_t refreshScreen;
 /* Thread to refresh periodically the status bar. */
@@ -14,27 +19,21 @@ static char error_messages[300];
 /* Is 1 if there was some insert or delete operation. Goes to 0 after the screen is updated. */
 static int dirty;
 
+/* Rows of the status area drawn by board_draw above the status bar, see setStatusBoard(). */
+static int board_rows = 0;
+static void (*board_draw)(int row, char *buf, int size) = NULL;
+
 /* Mutex to prevent unsychronized acceses to E static variable*/
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* Local functions */
-/*
- * Frees *tB. Could be replaced by free, it only adds readability.
- */
-static void tBufFree(tBuf *tB);
-
-/*
- * Append the string pointed by s to tB.
- */
-static void tBufAppend(tBuf *tB, const char *s, int len);
-
 /*
  * Get the current cursor position and save it to rows and cols
  */
 static int getCursorPosition(int *rows, int *cols);
 
 /*
- * Translate \t to spaces according to the TAB_STOP length.
+ * Translate \t to spaces according to the TAB_STOP length, and the cx bytes of the row to the columns they take.
  */
 static int translateTabs(tRow *row, int cx);
 
@@ -57,17 +56,6 @@ static void shellScroll(void);
  */
 static void refreshTerminal(void);
 
-/*
- * Appends every row to the buffer so the can be later written to stdout at once.
- */
-static void drawRows(tBuf *tB);
-
-/*
- * Append the app message to the tB buffer, this will normally be called after drawStatusBar. So it occupies the next
- * line.
- */
-static void drawAppMessage(tBuf *tb);
-
 /*
  * Get the current time and print it in the previous to last row using escape codes.
  */
@@ -88,6 +76,17 @@ static void freeRow(tRow *row);
  */
 static void insertRow(int line, char *s, size_t len);
 
+/*
+ * Adds the len bytes at s to the rows *rows that dumpRows() inserts, growing it from the n rows it has. *rows starts
+ * as the array stack, of DUMP_ROWS rows, and it's allocated once it doesn't fit.
+ */
+static void addDumpRow(tRowText **rows, int n, tRowText *stack, const char *s, size_t len);
+
+/*
+ * Fill row with a copy of the len bytes at s.
+ */
+static void initRow(tRow *row, int idx, const char *s, size_t len);
+
 /*
  * Checks a static variable if it's different than 0 to continue calling refreshTerminal().
  * This function is run in a separate thread.
@@ -108,11 +107,6 @@ void pexit(const char *s)
     exit(1);
 }
 
-static void tBufFree(tBuf *tB)
-{
-    free(tB->b);
-}
-
 termAttributes * initShellAttributes(void)
 {
     pthread_mutex_lock(&mutex);
@@ -129,8 +123,9 @@ termAttributes * initShellAttributes(void)
 
     if (getWindowSize(&E.screenrows, &E.screencols) == -1)
         pexit("getWindowSize");
-    /* Save one row for the status and one for the Message bar */
-    E.screenrows -= 2;
+    /* Save one row for the status and one for the Message bar, plus the rows of the board if there is one. */
+    E.boardrows = board_rows;
+    E.screenrows -= 2 + E.boardrows;
     pthread_mutex_unlock(&mutex);
 
     return &E;
@@ -167,6 +162,16 @@ static int getCursorPosition(int *rows, int *cols)
 
 static int getWindowSize(int *rows, int *cols)
 {
+    struct winsize ws;
+
+    /* The kernel knows the size of the terminal, asking the terminal itself costs a round trip. */
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row != 0 && ws.ws_col != 0)
+    {
+        *rows = ws.ws_row;
+        *cols = ws.ws_col;
+        return 0;
+    }
+
     /*Move the Cursor to the bottom right corner */
     if (write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12)
         return -1;
@@ -175,19 +180,6 @@ static int getWindowSize(int *rows, int *cols)
 }
 
 
-void tBufAppend(tBuf *tB, const char *s, int len)
-{
-    char *new = (char *)realloc(tB->b, tB->len + len);
-
-    if (new == 0)
-        pexit("tBufAppend");
-
-    memcpy(&new[tB->len], s, len);
-    tB->b = new;
-    tB->len += len;
-}
-
-
 static void disableRawMode(void)
 {
     th_run = 0;
@@ -197,6 +189,7 @@ static void disableRawMode(void)
     printf("%s\r", error_messages);
     delRows(0);
     free(E.row);
+    gridFree(&grid);
 
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
         pexit("tcsetattr");
@@ -231,6 +224,23 @@ static int translateTabs(tRow *row, int cx)
 {
     int rx = 0;
     int j;
+
+    if (!row->ascii)
+    {
+        for (j = 0; j < cx;)
+        {
+            int width;
+            unsigned int cp;
+
+            if (row->chars[j] == '\t')
+                rx += (TAB_STOP - 1) - (rx % TAB_STOP);
+
+            j += utf8Cluster(&row->chars[j], cx - j, &width, &cp);
+            rx += width;
+        }
+        return rx;
+    }
+
     for (j = 0; j < cx; j++)
     {
         if (row->chars[j] == '\t')
@@ -264,65 +274,6 @@ static void shellScroll(void)
         E.coloff = E.rx - E.screencols + 1;
 }
 
-static void drawRows(tBuf *tB)
-{
-    int y;
-    for (y = 0; y < E.screenrows; y++)
-    {
-        int filtRow = y + E.rowoff;
-        if (filtRow >= E.numrows)
-        {
-            tBufAppend(tB, "~", 1);
-        }
-        else
-        {
-            int len = E.row[filtRow].rsize - E.coloff;
-            if (len < 0) len = 0;
-            if (len > E.screencols)
-                len = E.screencols;
-
-            char *c = &E.row[filtRow].render[E.coloff];
-            int j;
-            for (j = 0; j < len; j++)
-            {
-                if (iscntrl(c[j]))
-                {
-                    char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-                    tBufAppend(tB, "\x1b[7m", 4);
-                    tBufAppend(tB, &sym, 1);
-                    tBufAppend(tB, "\x1b[m", 3);
-                }
-                else
-                {
-                    tBufAppend(tB, &c[j], 1);
-                }
-
-            }
-        }
-        tBufAppend(tB, "\x1b[K", 3);
-        tBufAppend(tB, "\r\n", 2);
-    }
-}
-
-static void drawAppMessage(tBuf *tB)
-{
-    /* Ensure there are no newline characters in the app msg */
-    for (int i = 0; i < sizeof(E.appmsg); i++)
-        if (E.appmsg[i] == '\n')
-        {
-            E.appmsg[i] = 0;
-            break;
-        }
-
-    /* If sizeof is used instead of strlen the message will be merged with previous. */
-    tBufAppend(tB, "\n", 1);
-
-    tBufAppend(tB, E.appmsg, strlen(E.appmsg));
-    if (E.appmsg[0])
-        tBufAppend(tB, "\x1b[39m", 5);
-    tBufAppend(tB, "\x1b[K", 3);
-}
-
 void setAppMessage(const char *fmt, ...)
 {
     pthread_mutex_lock(&mutex);
@@ -330,33 +281,25 @@ void setAppMessage(const char *fmt, ...)
     va_start(ap, fmt);
     vsnprintf(E.appmsg, sizeof(E.appmsg), fmt, ap);
     va_end(ap);
+    dirty = 1;
     pthread_mutex_unlock(&mutex);
 }
 
+void termSetMessage(termAttributes *T, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(T->appmsg, sizeof(T->appmsg), fmt, ap);
+    va_end(ap);
+}
+
 
 static void refreshTerminal()
 {
     dirty = 0;
     shellScroll();
 
-    tBuf tB = ABUF_INIT;
-
-    tBufAppend(&tB, "\x1b[?25l", 6);
-    tBufAppend(&tB, "\x1b[H", 3);
-
-    drawRows(&tB);
-    drawAppMessage(&tB);
-
-
-    char buf[32];
-    /* Move the cursor to the position indicated by E.cx and E.cy subtracting their respective offsets. */
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
-
-    tBufAppend(&tB, buf, strlen(buf));
-    tBufAppend(&tB, "\x1b[?25h", 6);
-
-    write(STDOUT_FILENO, tB.b, tB.len);
-    tBufFree(&tB);
+    gridRender(&grid, &E, STDOUT_FILENO);
 }
 
 void delRow(int line)
@@ -396,9 +339,7 @@ void delRows(int line)
 
 static void freeRow(tRow *row)
 {
-    free(row->render);
     free(row->chars);
-    free(row->hl);
 }
 
 void moveCursor(int key)
@@ -412,7 +353,10 @@ void moveCursor(int key)
         case ARROW_LEFT:
             if (E.cx != 0)
             {
+                /* Step over a whole UTF-8 sequence. */
                 E.cx--;
+                while (E.cx > 0 && (row->chars[E.cx] & 0xc0) == 0x80)
+                    E.cx--;
             }
             else if (E.cy > 0)
             {
@@ -425,6 +369,8 @@ void moveCursor(int key)
             if (row && E.cx < row->size)
             {
                 E.cx++;
+                while (E.cx < row->size && (row->chars[E.cx] & 0xc0) == 0x80)
+                    E.cx++;
             }
             else if (row && E.cx == row->size) {
                 E.cy++;
@@ -463,22 +409,85 @@ static void updateRow(tRow *row)
         if (row->chars[j] == '\t')
             tabs++;
 
-    free(row->render);
-    row->render = (char *)malloc(row->size + tabs*(TAB_STOP - 1) + 1);
+    row->ascii = utf8IsAscii(row->chars, row->size);
+
+    /* Without tabs the row is shown as it is. */
+    if (tabs == 0)
+    {
+        row->render = row->chars;
+        row->rsize = row->size;
+        row->width = 0;
+
+        if (row->ascii)
+            row->width = row->size;
+        else
+            for (j = 0; j < row->size;)
+            {
+                int width;
+                unsigned int cp;
+
+                j += utf8Cluster(&row->chars[j], row->size - j, &width, &cp);
+                row->width += width;
+            }
+
+        return;
+    }
+
+    /* The tabs are expanded after chars, in the same block. */
+    row->chars = (char *)realloc(row->chars, row->size + 1 + row->size + tabs*(TAB_STOP - 1) + 1);
+
+    if (row->chars == 0)
+        pexit("updateRow");
+
+    row->render = row->chars + row->size + 1;
 
     int idx = 0;
-    for (j = 0; j < row->size; j++)
+    if (row->ascii)
     {
-        if (row->chars[j] == '\t')
+        for (j = 0; j < row->size; j++)
         {
-            row->render[idx++] = ' ';
-            while (idx % TAB_STOP != 0)
+            if (row->chars[j] == '\t')
+            {
                 row->render[idx++] = ' ';
+                while (idx % TAB_STOP != 0)
+                    row->render[idx++] = ' ';
+            }
+            else
+            {
+                row->render[idx++] = row->chars[j];
+            }
         }
-        else
+        row->width = idx;
+    }
+    else
+    {
+        /* Tab stops depend on the columns taken so far, not on the bytes. */
+        int col = 0;
+        for (j = 0; j < row->size;)
         {
-            row->render[idx++] = row->chars[j];
+            if (row->chars[j] == '\t')
+            {
+                row->render[idx++] = ' ';
+                col++;
+                while (col % TAB_STOP != 0)
+                {
+                    row->render[idx++] = ' ';
+                    col++;
+                }
+                j++;
+                continue;
+            }
+
+            int width;
+            unsigned int cp;
+            int len = utf8Cluster(&row->chars[j], row->size - j, &width, &cp);
+
+            memcpy(&row->render[idx], &row->chars[j], len);
+            idx += len;
+            j += len;
+            col += width;
         }
+        row->width = col;
     }
     row->render[idx] = '\0';
     row->rsize = idx;
@@ -597,24 +606,30 @@ int getKey()
     }
 }
 
-void rowInsertChar(tRow *row, int line, int c)
+void rowInsertText(tRow *row, int line, const char *s, int len)
 {
     if (line < 0 || line > row->size)
         line = row->size;
 
     /* row->chars always comes from malloc */
-    row->chars = (char *)realloc(row->chars, row->size + 2);
+    row->chars = (char *)realloc(row->chars, row->size + len + 1);
 
     if (row->chars == 0)
         pexit("rowAppendString");
 
-    memmove(&row->chars[line + 1], &row->chars[line], row->size - line + 1);
-    row->size++;
-    row->chars[line] = c;
+    memmove(&row->chars[line + len], &row->chars[line], row->size - line + 1);
+    row->size += len;
+    memcpy(&row->chars[line], s, len);
     updateRow(row);
 }
 
 void insertChar(int c)
+{
+    char ch = c;
+    insertText(&ch, 1);
+}
+
+void insertText(const char *s, int len)
 {
     pthread_mutex_lock(&mutex);
     if (E.cy == E.numrows)
@@ -623,10 +638,12 @@ void insertChar(int c)
         insertRow(E.numrows, "", 0);
     }
 
-    rowInsertChar(&E.row[E.cy], E.cx, c);
+    rowInsertText(&E.row[E.cy], E.cx, s, len);
 
-    E.cx++;
-    if (E.cx == E.screencols - 1)
+    E.cx += len;
+    /* The row wraps by columns, which are the bytes before the cursor for plain ASCII. */
+    int col = E.row[E.cy].ascii ? E.cx : translateTabs(&E.row[E.cy], E.cx);
+    if (col >= E.screencols - 1)
     {
         E.cy = E.numrows;
         E.cx = 0;
@@ -637,38 +654,93 @@ void insertChar(int c)
 }
 
 
-void insertRow(int line, char *s, size_t len)
+static void insertRow(int line, char *s, size_t len)
+{
+    tRowText row = {s, len};
+
+    insertRows(line, &row, 1);
+}
+
+void insertRows(int line, const tRowText *rows, int n)
 {
     pthread_mutex_lock(&mutex);
-    if (line < 0 || line > E.numrows)
+    if (line < 0 || line > E.numrows || n <= 0)
     {
         pthread_mutex_unlock(&mutex);
         return;
     }
 
-    E.row = (tRow *)realloc(E.row, sizeof(tRow) * (E.numrows + 1));
+    E.row = (tRow *)realloc(E.row, sizeof(tRow) * (E.numrows + n));
 
     if (E.row == 0)
-        pexit("insertRow");
+        pexit("insertRows");
+
+    memmove(&E.row[line + n], &E.row[line], sizeof(tRow) * (E.numrows - line));
+    for (int j = line + n; j < E.numrows + n; j++)
+        E.row[j].idx += n;
+
+    for (int i = 0; i < n; i++)
+        initRow(&E.row[line + i], line + i, rows[i].s, rows[i].len);
+
+    E.numrows += n;
+    pthread_mutex_unlock(&mutex);
+}
 
-    memmove(&E.row[line + 1], &E.row[line], sizeof(tRow) * (E.numrows - line));
-    for (int j = line + 1; j <= E.numrows; j++)
-        E.row[j].idx++;
+static void initRow(tRow *row, int idx, const char *s, size_t len)
+{
+    row->idx = idx;
 
-    E.row[line].idx = line;
+    row->size = len;
+    row->chars = (char *)malloc(len + 1);
 
-    E.row[line].size = len;
-    E.row[line].chars = (char *)malloc(len + 1);
-    memcpy(E.row[line].chars, s, len);
-    E.row[line].chars[len] = '\0';
-    E.row[line].rsize = 0;
+    if (row->chars == 0)
+        pexit("initRow");
 
-    E.row[line].render = NULL;
-    E.row[line].hl = NULL;
-    updateRow(&E.row[line]);
+    memcpy(row->chars, s, len);
+    row->chars[len] = '\0';
+    row->rsize = 0;
 
-    E.numrows++;
-    pthread_mutex_unlock(&mutex);
+    row->render = row->chars;
+    updateRow(row);
+}
+
+void termAppendRow(termAttributes *T, const char *s, size_t len)
+{
+    T->row = (tRow *)realloc(T->row, sizeof(tRow) * (T->numrows + 1));
+
+    if (T->row == 0)
+        pexit("termAppendRow");
+
+    initRow(&T->row[T->numrows], T->numrows, s, len);
+    T->numrows++;
+}
+
+void termFreeRows(termAttributes *T)
+{
+    for (int j = 0; j < T->numrows; j++)
+        freeRow(&T->row[j]);
+
+    T->numrows = 0;
+}
+
+static void addDumpRow(tRowText **rows, int n, tRowText *stack, const char *s, size_t len)
+{
+    /* The array doubles every time it's full, which is when n is a power of 2 from DUMP_ROWS on. */
+    if (n >= DUMP_ROWS && (n & (n - 1)) == 0)
+    {
+        tRowText *bigger = (tRowText *)malloc(sizeof(tRowText) * n * 2);
+
+        if (bigger == NULL)
+            pexit("dumpRows");
+
+        memcpy(bigger, *rows, sizeof(tRowText) * n);
+        if (*rows != stack)
+            free(*rows);
+        *rows = bigger;
+    }
+
+    (*rows)[n].s = s;
+    (*rows)[n].len = len;
 }
 
 /*
@@ -680,65 +752,66 @@ int dumpRows(char *string, int maxLines, int line)
     int idx = 0;
     int len = 0;
     int rowsCopied = 0;
+    /* Columns taken by the len bytes of the current line. */
+    int width = 0;
+    /* The rows are found first, then inserted all at once. */
+    tRowText stack[DUMP_ROWS];
+    tRowText *rows = stack;
 
     if (line < 0 || line > E.numrows)
         return -1;
 
-    while (string[idx])
+    while (string[idx] && (maxLines == 0 || rowsCopied < maxLines))
     {
         if (string[idx] == '\n')
         {
-            insertRow(line + rowsCopied++, &string[idx++] - len, len);
+            addDumpRow(&rows, rowsCopied++, stack, &string[idx++] - len, len);
             len = 0;
-
-            if (maxLines == rowsCopied)
-            {
-                pthread_mutex_lock(&mutex);
-
-                E.cy = E.numrows;
-                E.cx = 0;
-
-                pthread_mutex_unlock(&mutex);
-
-                return idx;
-            }
+            width = 0;
         }
         else
         {
-            if (len == E.screencols - 2)
-            {
-                insertRow(line + rowsCopied, &string[idx++] - len, len + 1);
-                len = 0;
-                rowsCopied++;
-
-                if (maxLines == rowsCopied)
-                {
-                    pthread_mutex_lock(&mutex);
-
-                    E.cy = E.numrows;
-                    E.cx = 0;
+            int n = 1;
+            int w = 1;
 
-                    pthread_mutex_unlock(&mutex);
+            /* Combining marks after a plain letter belong to it, so the next byte is checked too. */
+            if ((unsigned char)string[idx] >= 0x80 || (unsigned char)string[idx + 1] >= 0x80)
+            {
+                unsigned int cp;
+                n = utf8Cluster(&string[idx], strnlen(&string[idx], UTF8_CLUSTER_MAX), &w, &cp);
+            }
 
-                    return idx;
-                }
+            /*
+             * The row is split after the character that reaches the last but one column, like insertText() does. A
+             * wide character can take the last column too.
+             */
+            if (width + w >= E.screencols - 1)
+            {
+                idx += n;
+                len += n;
+                addDumpRow(&rows, rowsCopied++, stack, &string[idx] - len, len);
+                len = 0;
+                width = 0;
             }
             else
             {
-                len++;
-                idx++;
+                len += n;
+                idx += n;
+                width += w;
             }
         }
     }
 
     if (len)
-    {
-        insertRow(line + rowsCopied++, &string[idx] - len, len);
-    }
+        addDumpRow(&rows, rowsCopied++, stack, &string[idx] - len, len);
 
     /*This ensures that an exact number of lines will be dumped if the number isn't 0. */
-    for (int i = rowsCopied; i < maxLines; i++, rowsCopied++)
-        insertRow(line + i, "", 0);
+    while (rowsCopied < maxLines)
+        addDumpRow(&rows, rowsCopied++, stack, "", 0);
+
+    insertRows(line, rows, rowsCopied);
+    if (rows != stack)
+        free(rows);
 
     pthread_mutex_lock(&mutex);
 
@@ -752,12 +825,21 @@ int dumpRows(char *string, int maxLines, int line)
 
 static void keepRefresing(void)
 {
+    int painted = 0;
+
     while (th_run)
     {
         pthread_mutex_lock(&mutex);
 
         if (dirty)
+        {
             refreshTerminal();
+            if (!painted)
+            {
+                painted = 1;
+                traceMark("first paint");
+            }
+        }
 
         pthread_mutex_unlock(&mutex);
 
@@ -771,6 +853,12 @@ termAttributes * getTermAttributes(void)
     return &E;
 }
 
+void setStatusBoard(int rows, void (*draw)(int row, char *buf, int size))
+{
+    board_rows = rows;
+    board_draw = draw;
+}
+
 static void printStatusMessage(void)
 {
     while (th_run)
@@ -785,6 +873,17 @@ static void printStatusMessage(void)
         write(STDOUT_FILENO, message, strlen(message));
         free(message);
 
+        /* The board goes first, the status bar comes after its rows. */
+        for (int i = 0; i < E.boardrows; i++)
+        {
+            char line[512];
+
+            board_draw(i, line, E.screencols < (int)sizeof(line) - 64 ? E.screencols : (int)sizeof(line) - 64);
+            asprintf(&message, "\x1b[K%s\r\n", line);
+            write(STDOUT_FILENO, message, strlen(message));
+            free(message);
+        }
+
         /* Get the current time and print it in that line. */
         struct tm * timeinfo;
         time_t currentTime= time(NULL);
@@ -0,0 +1,890 @@
+#define _GNU_SOURCE // getline, asprintf and strcasecmp
+
+#include <records_io.h>
+#include <speed_test_sqlite.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+/* Defines */
+
+/* Columns of Records found in a CSV header or a JSON object. */
+#define COL_FINGERS 0
+#define COL_LENGTH 1
+#define COL_MISTAKES 2
+#define COL_TIME 3
+#define COL_STARTED_AT 4
+#define RECORDS_COLUMNS 5
+/* The columns before this one have to be in a CSV header, older exports have no StartedAt. */
+#define RECORDS_REQUIRED 4
+/* Fields of a CSV row, including the ones that are skipped. */
+#define CSV_FIELDS 32
+
+/* Type definitios */
+
+/*
+ * State of an import: the prepared insert and the transaction it's running in.
+ */
+typedef struct tImport
+{
+    sqlite3 *db;
+    sqlite3_stmt *insert;
+    long long rows;
+    int inBatch;
+    long line;
+} tImport;
+
+/* Local functions */
+
+/*
+ * Names of the columns, as written in the header and the objects.
+ */
+static const char *columns[RECORDS_COLUMNS] = {"Fingers", "Length", "Mistakes", "Time", "StartedAt"};
+
+/*
+ * Returns the column named name, or -1 if Records doesn't have it.
+ */
+static int columnIndex(const char *name);
+
+/*
+ * Opens path for the export or the import, "-" is the standard stream given. The stream gets a buffer of
+ * RECORDS_BUFFER bytes.
+ */
+static FILE *openStream(const char *path, const char *mode, FILE *std);
+
+/*
+ * Writes s as a CSV field, quoted only when it has to be.
+ */
+static void writeCsvField(FILE *out, const char *s);
+
+/*
+ * Writes s as a JSON string.
+ */
+static void writeJsonString(FILE *out, const char *s);
+
+/*
+ * Validates a row and inserts it, a NULL or empty value is stored as NULL. Returns 0 or 1 on error.
+ */
+static int importRow(tImport *im, char **value);
+
+/*
+ * Reads a whole CSV record, which may take more than a line when a quoted field has a newline. *line is grown as
+ * needed. Returns the length of the record or -1 at the end of the file.
+ */
+static ssize_t readCsvRecord(FILE *in, char **line, size_t *size, long *lines);
+
+/*
+ * Splits the CSV record s in place, unquoting its fields. Returns the number of fields or -1 if there are more than
+ * max or a quote isn't closed.
+ */
+static int splitCsv(char *s, char **field, int max);
+
+/*
+ * Parses a JSON string starting after its opening quote and decodes it in place. *s is left after the closing
+ * quote. Returns the decoded string or NULL if it's malformed.
+ */
+static char *parseJsonString(char **s);
+
+/*
+ * Parses the object of a NDJSON line in place, setting value to the members named like the columns. Returns 0 or 1
+ * if the line isn't a flat JSON object.
+ */
+static int parseJsonObject(char *s, char **value);
+
+/*
+ * Imports every row of a CSV or NDJSON stream.
+ */
+static int importCsv(tImport *im, FILE *in);
+static int importNdjson(tImport *im, FILE *in);
+
+/*
+ * Adds the results of the database path to Records, see recordsMerge(). *added and *skipped count its rows. Returns 0
+ * or 1 on error.
+ */
+static int mergeDb(sqlite3 *db, const char *path, long long *added, long long *skipped);
+
+static int columnIndex(const char *name)
+{
+    for (int i = 0; i < RECORDS_COLUMNS; i++)
+        if (strcasecmp(name, columns[i]) == 0)
+            return i;
+
+    return -1;
+}
+
+static FILE *openStream(const char *path, const char *mode, FILE *std)
+{
+    FILE *f = strcmp(path, "-") == 0 ? std : fopen(path, mode);
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    setvbuf(f, NULL, _IOFBF, RECORDS_BUFFER);
+
+    return f;
+}
+
+int recordsFormat(const char *path, const char *name)
+{
+    if (name)
+    {
+        if (strcasecmp(name, "csv") == 0)
+            return RECORDS_CSV;
+        if (strcasecmp(name, "ndjson") == 0)
+            return RECORDS_NDJSON;
+
+        return -1;
+    }
+
+    const char *ext = strrchr(path, '.');
+
+    if (ext && (strcasecmp(ext, ".ndjson") == 0 || strcasecmp(ext, ".jsonl") == 0 || strcasecmp(ext, ".json") == 0))
+        return RECORDS_NDJSON;
+
+    return RECORDS_CSV;
+}
+
+static void writeCsvField(FILE *out, const char *s)
+{
+    if (s[strcspn(s, ",\"\r\n")] == '\0')
+    {
+        fputs(s, out);
+        return;
+    }
+
+    putc('"', out);
+    for (; *s; s++)
+    {
+        if (*s == '"')
+            putc('"', out);
+        putc(*s, out);
+    }
+    putc('"', out);
+}
+
+static void writeJsonString(FILE *out, const char *s)
+{
+    putc('"', out);
+    for (; *s; s++)
+    {
+        unsigned char c = *s;
+
+        if (c == '"' || c == '\\')
+        {
+            putc('\\', out);
+            putc(c, out);
+        }
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            putc(c, out);
+    }
+    putc('"', out);
+}
+
+int recordsExport(const char *path, int format)
+{
+    sqlite3 *db = get_db();
+    sqlite3_stmt *res;
+    long long rows = 0;
+
+    FILE *out = openStream(path, "w", stdout);
+    if (out == NULL)
+        return 1;
+
+    /* Id is left out, it only means something in the database the row comes from. */
+    int rc = sqlite3_prepare_v2(db, "SELECT Fingers, Length, Mistakes, Time, StartedAt FROM Records ORDER BY Id;", -1, &res, 0);
+
+    if (rc != SQLITE_OK)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        if (out != stdout)
+            fclose(out);
+
+        return 1;
+    }
+
+    if (format == RECORDS_CSV)
+        fprintf(out, "%s,%s,%s,%s,%s\n", columns[0], columns[1], columns[2], columns[3], columns[4]);
+
+    while ((rc = sqlite3_step(res)) == SQLITE_ROW)
+    {
+        if (format == RECORDS_NDJSON)
+            putc('{', out);
+
+        for (int i = 0; i < RECORDS_COLUMNS; i++)
+        {
+            const char *v = (const char *)sqlite3_column_text(res, i);
+
+            if (format == RECORDS_CSV)
+            {
+                if (i)
+                    putc(',', out);
+                if (v)
+                    writeCsvField(out, v);
+                continue;
+            }
+
+            if (i)
+                putc(',', out);
+            writeJsonString(out, columns[i]);
+            putc(':', out);
+
+            /* The numbers are written the way sqlite prints them, which is valid JSON too. */
+            if (v == NULL)
+                fputs("null", out);
+            else if (i == COL_FINGERS)
+                writeJsonString(out, v);
+            else
+                fputs(v, out);
+        }
+
+        if (format == RECORDS_NDJSON)
+            putc('}', out);
+        putc('\n', out);
+        rows++;
+    }
+
+    sqlite3_finalize(res);
+
+    if (rc != SQLITE_DONE)
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+
+    int failed = rc != SQLITE_DONE || fflush(out) != 0 || ferror(out);
+    if (out != stdout && fclose(out) != 0)
+        failed = 1;
+
+    if (failed)
+    {
+        fprintf(stderr, "Can't write %s\n", path);
+        return 1;
+    }
+
+    fprintf(stderr, "Exported %lld results\n", rows);
+
+    return 0;
+}
+
+static int importRow(tImport *im, char **value)
+{
+    for (int i = 0; i < RECORDS_COLUMNS; i++)
+    {
+        char *v = value[i];
+        char *end;
+
+        if (v == NULL || v[0] == '\0')
+        {
+            sqlite3_bind_null(im->insert, i + 1);
+            continue;
+        }
+
+        if (i == COL_FINGERS)
+        {
+            sqlite3_bind_text(im->insert, i + 1, v, -1, SQLITE_STATIC);
+            continue;
+        }
+
+        errno = 0;
+        if (i == COL_TIME)
+        {
+            double d = strtod(v, &end);
+            if (*end == '\0' && errno == 0)
+            {
+                sqlite3_bind_double(im->insert, i + 1, d);
+                continue;
+            }
+        }
+        else
+        {
+            long long n = strtoll(v, &end, 10);
+            if (*end == '\0' && errno == 0)
+            {
+                sqlite3_bind_int64(im->insert, i + 1, n);
+                continue;
+            }
+        }
+
+        fprintf(stderr, "Line %ld: %s isn't a valid %s\n", im->line, v, columns[i]);
+        return 1;
+    }
+
+    if (!im->inBatch)
+    {
+        if (begin_bulk_insert())
+            return 1;
+        im->inBatch = 1;
+    }
+
+    if (sqlite3_step(im->insert) != SQLITE_DONE)
+    {
+        fprintf(stderr, "Line %ld: SQL error: %s\n", im->line, sqlite3_errmsg(im->db));
+        sqlite3_reset(im->insert);
+        return 1;
+    }
+
+    sqlite3_reset(im->insert);
+
+    if (++im->rows % RECORDS_BATCH == 0)
+    {
+        im->inBatch = 0;
+        if (end_bulk_insert(1))
+            return 1;
+    }
+
+    return 0;
+}
+
+static ssize_t readCsvRecord(FILE *in, char **line, size_t *size, long *lines)
+{
+    ssize_t len = getline(line, size, in);
+
+    if (len == -1)
+        return -1;
+    (*lines)++;
+
+    /* An odd number of quotes means a quoted field goes on in the next line. */
+    for (;;)
+    {
+        int quotes = 0;
+        for (ssize_t i = 0; i < len; i++)
+            quotes += (*line)[i] == '"';
+
+        if (quotes % 2 == 0)
+            break;
+
+        char *more = NULL;
+        size_t moreSize = 0;
+        ssize_t n = getline(&more, &moreSize, in);
+
+        if (n == -1)
+        {
+            free(more);
+            break;
+        }
+        (*lines)++;
+
+        if ((size_t)(len + n + 1) > *size)
+        {
+            *size = len + n + 1;
+            char *grown = (char *)realloc(*line, *size);
+            if (grown == NULL)
+                pexit("readCsvRecord");
+            *line = grown;
+        }
+
+        memcpy(*line + len, more, n + 1);
+        len += n;
+        free(more);
+    }
+
+    while (len && ((*line)[len - 1] == '\n' || (*line)[len - 1] == '\r'))
+        (*line)[--len] = '\0';
+
+    return len;
+}
+
+static int splitCsv(char *s, char **field, int max)
+{
+    int n = 0;
+    char *w = s;
+
+    for (;;)
+    {
+        if (n == max)
+            return -1;
+        field[n++] = w;
+
+        if (*s == '"')
+        {
+            for (s++;; s++)
+            {
+                if (*s == '\0')
+                    return -1;
+                if (*s == '"')
+                {
+                    if (s[1] != '"')
+                        break;
+                    s++;
+                }
+                *w++ = *s;
+            }
+            s++;
+        }
+
+        while (*s && *s != ',')
+            *w++ = *s++;
+
+        if (*s == '\0')
+        {
+            *w = '\0';
+            return n;
+        }
+
+        *w++ = '\0';
+        s++;
+    }
+}
+
+static int importCsv(tImport *im, FILE *in)
+{
+    char *line = NULL;
+    size_t size = 0;
+    char *field[CSV_FIELDS];
+    int map[CSV_FIELDS];
+    int nfields;
+    int rc = 0;
+
+    if (readCsvRecord(in, &line, &size, &im->line) == -1 || (nfields = splitCsv(line, field, CSV_FIELDS)) == -1)
+    {
+        fprintf(stderr, "The CSV file has no valid header\n");
+        free(line);
+        return 1;
+    }
+
+    /* Spreadsheets may start the file with a byte order mark. */
+    if (strncmp(field[0], "\xef\xbb\xbf", 3) == 0)
+        field[0] += 3;
+
+    int found = 0;
+    for (int i = 0; i < nfields; i++)
+    {
+        map[i] = columnIndex(field[i]);
+        if (map[i] != -1)
+            found |= 1 << map[i];
+    }
+
+    for (int i = 0; i < RECORDS_REQUIRED; i++)
+        if (!(found & (1 << i)))
+        {
+            fprintf(stderr, "The CSV header has no %s column\n", columns[i]);
+            free(line);
+            return 1;
+        }
+
+    while (readCsvRecord(in, &line, &size, &im->line) != -1)
+    {
+        char *value[RECORDS_COLUMNS] = {NULL};
+
+        if (line[0] == '\0')
+            continue;
+
+        if (splitCsv(line, field, CSV_FIELDS) != nfields)
+        {
+            fprintf(stderr, "Line %ld: expected %d fields\n", im->line, nfields);
+            rc = 1;
+            break;
+        }
+
+        for (int i = 0; i < nfields; i++)
+            if (map[i] != -1)
+                value[map[i]] = field[i];
+
+        if ((rc = importRow(im, value)))
+            break;
+    }
+
+    free(line);
+
+    return rc;
+}
+
+static char *parseJsonString(char **s)
+{
+    char *r = *s, *w = *s, *start = *s;
+
+    for (;;)
+    {
+        unsigned char c = *r++;
+
+        if (c == '\0' || c < 0x20)
+            return NULL;
+        if (c == '"')
+            break;
+        if (c != '\\')
+        {
+            *w++ = c;
+            continue;
+        }
+
+        c = *r++;
+        switch (c)
+        {
+            case '"': case '\\': case '/': *w++ = c; break;
+            case 'b': *w++ = '\b'; break;
+            case 'f': *w++ = '\f'; break;
+            case 'n': *w++ = '\n'; break;
+            case 'r': *w++ = '\r'; break;
+            case 't': *w++ = '\t'; break;
+            case 'u':
+            {
+                unsigned long cp;
+                char hex[5] = {0};
+                char *end;
+
+                if (strnlen(r, 4) < 4)
+                    return NULL;
+                memcpy(hex, r, 4);
+                cp = strtoul(hex, &end, 16);
+                if (end != hex + 4)
+                    return NULL;
+                r += 4;
+
+                /* A high surrogate has to be followed by the low one. */
+                if (cp >= 0xd800 && cp < 0xdc00 && r[0] == '\\' && r[1] == 'u' && strnlen(r + 2, 4) == 4)
+                {
+                    memcpy(hex, r + 2, 4);
+                    unsigned long low = strtoul(hex, &end, 16);
+                    if (end == hex + 4 && low >= 0xdc00 && low < 0xe000)
+                    {
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                        r += 6;
+                    }
+                }
+
+                if (cp >= 0xd800 && cp < 0xe000)
+                    return NULL;
+
+                /* The UTF-8 sequence is never longer than the escape it comes from. */
+                if (cp < 0x80)
+                    *w++ = cp;
+                else if (cp < 0x800)
+                {
+                    *w++ = 0xc0 | (cp >> 6);
+                    *w++ = 0x80 | (cp & 0x3f);
+                }
+                else if (cp < 0x10000)
+                {
+                    *w++ = 0xe0 | (cp >> 12);
+                    *w++ = 0x80 | ((cp >> 6) & 0x3f);
+                    *w++ = 0x80 | (cp & 0x3f);
+                }
+                else
+                {
+                    *w++ = 0xf0 | (cp >> 18);
+                    *w++ = 0x80 | ((cp >> 12) & 0x3f);
+                    *w++ = 0x80 | ((cp >> 6) & 0x3f);
+                    *w++ = 0x80 | (cp & 0x3f);
+                }
+                break;
+            }
+            default:
+                return NULL;
+        }
+    }
+
+    *w = '\0';
+    *s = r;
+
+    return start;
+}
+
+static int parseJsonObject(char *s, char **value)
+{
+    while (isspace((unsigned char)*s))
+        s++;
+    if (*s++ != '{')
+        return 1;
+
+    while (isspace((unsigned char)*s))
+        s++;
+    if (*s == '}')
+        return 0;
+
+    for (;;)
+    {
+        while (isspace((unsigned char)*s))
+            s++;
+        if (*s++ != '"')
+            return 1;
+
+        char *key = parseJsonString(&s);
+        if (key == NULL)
+            return 1;
+
+        while (isspace((unsigned char)*s))
+            s++;
+        if (*s++ != ':')
+            return 1;
+        while (isspace((unsigned char)*s))
+            s++;
+
+        char *v;
+        int quoted = *s == '"';
+        if (quoted)
+        {
+            s++;
+            if ((v = parseJsonString(&s)) == NULL)
+                return 1;
+        }
+        else
+        {
+            /* A number, true, false or null. Nested values aren't part of a result. */
+            v = s;
+            while (*s && !isspace((unsigned char)*s) && *s != ',' && *s != '}')
+                s++;
+            if (s == v || *v == '{' || *v == '[')
+                return 1;
+        }
+
+        char *end = s;
+        while (isspace((unsigned char)*s))
+            s++;
+
+        char sep = *s++;
+        if (sep != ',' && sep != '}')
+            return 1;
+        /* The separator is read, so the value can end here. */
+        *end = '\0';
+
+        int col = columnIndex(key);
+        if (col != -1)
+            value[col] = !quoted && strcmp(v, "null") == 0 ? NULL : v;
+
+        if (sep == '}')
+            break;
+    }
+
+    while (isspace((unsigned char)*s))
+        s++;
+
+    return *s != '\0';
+}
+
+static int importNdjson(tImport *im, FILE *in)
+{
+    char *line = NULL;
+    size_t size = 0;
+    int rc = 0;
+
+    while (getline(&line, &size, in) != -1)
+    {
+        char *value[RECORDS_COLUMNS] = {NULL};
+        char *s = line;
+
+        im->line++;
+        while (isspace((unsigned char)*s))
+            s++;
+        if (*s == '\0')
+            continue;
+
+        if (parseJsonObject(s, value))
+        {
+            fprintf(stderr, "Line %ld: not a JSON object\n", im->line);
+            rc = 1;
+            break;
+        }
+
+        if ((rc = importRow(im, value)))
+            break;
+    }
+
+    free(line);
+
+    return rc;
+}
+
+int recordsImport(const char *path)
+{
+    tImport im = {get_db(), NULL, 0, 0, 0};
+
+    FILE *in = openStream(path, "r", stdin);
+    if (in == NULL)
+        return 1;
+
+    /* The rows land all over the indexes of Records, they are updated much faster when they fit in the cache. */
+    sqlite3_exec(im.db, "PRAGMA cache_size=-" DB_STR(RECORDS_CACHE_KIB) ";", 0, 0, 0);
+
+    int rc = sqlite3_prepare_v2(im.db, "INSERT INTO Records(Fingers, Length, Mistakes, Time, StartedAt) \
+            VALUES(?, ?, ?, ?, ?);", -1, &im.insert, 0);
+
+    if (rc != SQLITE_OK)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(im.db));
+        if (in != stdin)
+            fclose(in);
+
+        return 1;
+    }
+
+    /* A NDJSON file starts with an object, anything else has to be the header of a CSV file. */
+    int c;
+    while ((c = getc(in)) != EOF && isspace(c))
+        ;
+    if (c != EOF)
+        ungetc(c, in);
+
+    if (c == EOF)
+        rc = 0;
+    else
+        rc = c == '{' ? importNdjson(&im, in) : importCsv(&im, in);
+
+    if (im.inBatch)
+    {
+        if (rc)
+            im.rows -= im.rows % RECORDS_BATCH;
+        if (end_bulk_insert(!rc))
+            rc = 1;
+    }
+
+    sqlite3_finalize(im.insert);
+    if (ferror(in))
+    {
+        fprintf(stderr, "Can't read %s\n", path);
+        rc = 1;
+    }
+    if (in != stdin)
+        fclose(in);
+
+    fprintf(stderr, "Imported %lld results\n", im.rows);
+
+    return rc;
+}
+
+static int mergeDb(sqlite3 *db, const char *path, long long *added, long long *skipped)
+{
+    sqlite3_stmt *attach, *bound = NULL, *insert = NULL;
+    int rc = 1;
+
+    /* ATTACH would create a database that doesn't exist. */
+    if (access(path, R_OK))
+    {
+        fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    if (sqlite3_prepare_v2(db, "ATTACH ? AS src;", -1, &attach, 0) != SQLITE_OK)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        return 1;
+    }
+
+    sqlite3_bind_text(attach, 1, path, -1, SQLITE_STATIC);
+    int attached = sqlite3_step(attach) == SQLITE_DONE;
+    sqlite3_finalize(attach);
+
+    if (!attached)
+    {
+        fprintf(stderr, "Can't attach %s: %s\n", path, sqlite3_errmsg(db));
+        return 1;
+    }
+
+    /* The databases made before StartedAt existed have no start times. */
+    const char *startedAt = "NULL";
+    sqlite3_stmt *res;
+
+    if (sqlite3_prepare_v2(db, "SELECT name FROM pragma_table_info('Records', 'src') WHERE name = 'StartedAt';", -1,
+            &res, 0) == SQLITE_OK)
+    {
+        if (sqlite3_step(res) == SQLITE_ROW)
+            startedAt = "r.StartedAt";
+        sqlite3_finalize(res);
+    }
+
+    /*
+     * Each batch is the next RECORDS_BATCH rows by Id, the first statement finds where it ends. A row is skipped when
+     * Records has the same one, it's looked up with the index on (Fingers, Time, Length): a test has few results
+     * with the same time.
+     */
+    char *sql;
+    if (asprintf(&sql, "INSERT INTO main.Records(Fingers, Length, Mistakes, Time, StartedAt) \
+            SELECT r.Fingers, r.Length, r.Mistakes, r.Time, %1$s FROM src.Records r WHERE r.Id > ?1 AND r.Id <= ?2 \
+            AND NOT EXISTS (SELECT 1 FROM main.Records m \
+                WHERE m.Fingers IS r.Fingers AND m.Time IS r.Time AND m.Length IS r.Length \
+                AND m.Mistakes IS r.Mistakes AND m.StartedAt IS %1$s) \
+            ORDER BY r.Id;", startedAt) < 0)
+        sql = NULL;
+
+    if (sql == NULL ||
+            sqlite3_prepare_v2(db, "SELECT COUNT(*), MAX(Id) FROM (SELECT Id FROM src.Records WHERE Id > ? \
+                ORDER BY Id LIMIT " DB_STR(RECORDS_BATCH) ");", -1, &bound, 0) != SQLITE_OK ||
+            sqlite3_prepare_v2(db, sql, -1, &insert, 0) != SQLITE_OK)
+    {
+        fprintf(stderr, "Can't merge %s: %s\n", path, sqlite3_errmsg(db));
+        goto END;
+    }
+
+    sqlite3_int64 last = 0;
+    long long rows = 0, before = *added;
+
+    for (;;)
+    {
+        sqlite3_bind_int64(bound, 1, last);
+        if (sqlite3_step(bound) != SQLITE_ROW)
+        {
+            fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+            break;
+        }
+
+        int count = sqlite3_column_int(bound, 0);
+        sqlite3_int64 end = sqlite3_column_int64(bound, 1);
+        sqlite3_reset(bound);
+
+        if (count == 0)
+        {
+            rc = 0;
+            break;
+        }
+
+        sqlite3_bind_int64(insert, 1, last);
+        sqlite3_bind_int64(insert, 2, end);
+
+        if (begin_bulk_insert())
+            break;
+
+        if (sqlite3_step(insert) != SQLITE_DONE)
+        {
+            fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+            end_bulk_insert(0);
+            break;
+        }
+
+        int changes = sqlite3_changes(db);
+        sqlite3_reset(insert);
+
+        if (end_bulk_insert(1))
+            break;
+
+        *added += changes;
+        rows += count;
+        last = end;
+    }
+
+    *skipped += rows - (*added - before);
+
+END:
+    sqlite3_finalize(bound);
+    sqlite3_finalize(insert);
+    free(sql);
+    sqlite3_exec(db, "DETACH src;", 0, 0, 0);
+
+    return rc;
+}
+
+int recordsMerge(char **paths, int n)
+{
+    sqlite3 *db = get_db();
+    long long added = 0, skipped = 0;
+    int rc = 0;
+
+    /* Like an import, the rows land all over the indexes. */
+    sqlite3_exec(db, "PRAGMA cache_size=-" DB_STR(RECORDS_CACHE_KIB) ";", 0, 0, 0);
+
+    for (int i = 0; i < n && rc == 0; i++)
+    {
+        long long a = added, s = skipped;
+
+        rc = mergeDb(db, paths[i], &added, &skipped);
+        if (rc == 0)
+            fprintf(stderr, "%s: %lld results added, %lld already there\n", paths[i], added - a, skipped - s);
+    }
+
+    fprintf(stderr, "Merged %lld results, skipped %lld\n", added, skipped);
+
+    return rc;
+}
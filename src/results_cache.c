@@ -0,0 +1,420 @@
+#define _GNU_SOURCE // qsort_r
+
+#include <results_cache.h>
+#include <raw_term.h>
+#include <startup_trace.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Type definitios */
+
+/*
+ * A result saved while the cache was loading.
+ */
+typedef struct tPending
+{
+    sqlite3_int64 id;
+    char *name;
+    int length;
+    int mistakes;
+    double time;
+    struct tPending *next;
+} tPending;
+
+/* Local functions */
+
+/*
+ * Loads every result of the database, arg is its path. It runs in the loader thread.
+ */
+static void *cacheLoader(void *arg);
+
+/*
+ * Adds a result to its test and group. With sorted the columns stay in order, otherwise it's appended and the group
+ * has to be sorted with sortGroup() afterwards.
+ */
+static void addResult(sqlite3_int64 id, const char *name, int length, int mistakes, double time, int sorted);
+
+/*
+ * Returns the test name, creating it if create is set. *pos is where it is or would go in tests.
+ */
+static tTestCache *findTest(const char *name, int create);
+
+/*
+ * Sorts the columns of g by time, length and id.
+ */
+static void sortGroup(tResultCols *g);
+
+/*
+ * Compares the rows a and b of the group g by time, length and id.
+ */
+static int compareRows(const void *a, const void *b, void *g);
+
+/* Static variables */
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t loader;
+static int started = 0;
+static int ready = 0;
+static int (*group_key)(const char *name, int length);
+
+/* Every test sorted by name, the pointers stay valid as the array grows. */
+static tTestCache **tests = NULL;
+static int ntests = 0;
+static int capTests = 0;
+
+/* Results saved during the load, the newest first. */
+static tPending *pending = NULL;
+
+/* The result added last, see cacheLast(). */
+static tTestCache *lastTest = NULL;
+static int lastKey;
+static double lastTime;
+
+void cacheStart(const char *path, int (*groupKey)(const char *name, int length))
+{
+    char *copy = strdup(path);
+
+    if (copy == NULL)
+        pexit("cacheStart");
+
+    group_key = groupKey;
+    started = 1;
+
+    if (pthread_create(&loader, NULL, cacheLoader, copy))
+        pexit("cacheStart");
+    pthread_detach(loader);
+}
+
+int cacheReady(void)
+{
+    pthread_mutex_lock(&mutex);
+    int r = ready;
+    pthread_mutex_unlock(&mutex);
+
+    return r;
+}
+
+static tTestCache *findTest(const char *name, int create)
+{
+    int lo = 0, hi = ntests;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        int c = strcmp(tests[mid]->name, name);
+
+        if (c == 0)
+            return tests[mid];
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (!create)
+        return NULL;
+
+    if (ntests == capTests)
+    {
+        capTests = capTests ? capTests * 2 : 16;
+        tests = (tTestCache **)realloc(tests, sizeof(tTestCache *) * capTests);
+        if (tests == NULL)
+            pexit("findTest");
+    }
+
+    tTestCache *t = (tTestCache *)calloc(1, sizeof(tTestCache));
+    if (t == NULL || (t->name = strdup(name)) == NULL)
+        pexit("findTest");
+
+    memmove(&tests[lo + 1], &tests[lo], sizeof(tTestCache *) * (ntests - lo));
+    tests[lo] = t;
+    ntests++;
+
+    return t;
+}
+
+static void addResult(sqlite3_int64 id, const char *name, int length, int mistakes, double time, int sorted)
+{
+    tTestCache *t = findTest(name, 1);
+    int key = group_key(name, length);
+    tResultCols *g = NULL;
+
+    for (int i = 0; i < t->ngroups && g == NULL; i++)
+        if (t->groups[i].key == key)
+            g = &t->groups[i];
+
+    if (g == NULL)
+    {
+        t->groups = (tResultCols *)realloc(t->groups, sizeof(tResultCols) * (t->ngroups + 1));
+        if (t->groups == NULL)
+            pexit("addResult");
+
+        g = &t->groups[t->ngroups++];
+        memset(g, 0, sizeof(tResultCols));
+        g->key = key;
+    }
+
+    if (g->n == g->cap)
+    {
+        g->cap = g->cap ? g->cap * 2 : CACHE_GROUP_INIT;
+        g->time = (double *)realloc(g->time, sizeof(double) * g->cap);
+        g->length = (int *)realloc(g->length, sizeof(int) * g->cap);
+        g->mistakes = (int *)realloc(g->mistakes, sizeof(int) * g->cap);
+        g->id = (sqlite3_int64 *)realloc(g->id, sizeof(sqlite3_int64) * g->cap);
+
+        if (g->time == NULL || g->length == NULL || g->mistakes == NULL || g->id == NULL)
+            pexit("addResult");
+    }
+
+    /* A new result has the largest id, so it goes after every row with the same time and length. */
+    int pos = g->n;
+    if (sorted)
+    {
+        int lo = 0, hi = g->n;
+        while (lo < hi)
+        {
+            int mid = (lo + hi) / 2;
+            if (g->time[mid] < time || (g->time[mid] == time && g->length[mid] <= length))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        pos = lo;
+
+        int tail = g->n - pos;
+        memmove(&g->time[pos + 1], &g->time[pos], sizeof(double) * tail);
+        memmove(&g->length[pos + 1], &g->length[pos], sizeof(int) * tail);
+        memmove(&g->mistakes[pos + 1], &g->mistakes[pos], sizeof(int) * tail);
+        memmove(&g->id[pos + 1], &g->id[pos], sizeof(sqlite3_int64) * tail);
+    }
+
+    g->time[pos] = time;
+    g->length[pos] = length;
+    g->mistakes[pos] = mistakes;
+    g->id[pos] = id;
+    g->n++;
+
+    /* The totals of the length, a test has few different lengths. */
+    int l = 0;
+    while (l < t->nlens && t->lens[l].length < length)
+        l++;
+
+    if (l == t->nlens || t->lens[l].length != length)
+    {
+        t->lens = (tLengthStats *)realloc(t->lens, sizeof(tLengthStats) * (t->nlens + 1));
+        if (t->lens == NULL)
+            pexit("addResult");
+
+        memmove(&t->lens[l + 1], &t->lens[l], sizeof(tLengthStats) * (t->nlens - l));
+        memset(&t->lens[l], 0, sizeof(tLengthStats));
+        t->lens[l].length = length;
+        t->nlens++;
+    }
+
+    t->lens[l].count++;
+    t->lens[l].sumTime += time;
+    t->lens[l].sumMistakes += mistakes;
+
+    lastTest = t;
+    lastKey = key;
+    lastTime = time;
+}
+
+static int compareRows(const void *a, const void *b, void *g)
+{
+    const tResultCols *c = (const tResultCols *)g;
+    int i = *(const int *)a, j = *(const int *)b;
+
+    if (c->time[i] != c->time[j])
+        return c->time[i] < c->time[j] ? -1 : 1;
+    if (c->length[i] != c->length[j])
+        return c->length[i] < c->length[j] ? -1 : 1;
+
+    return c->id[i] < c->id[j] ? -1 : c->id[i] > c->id[j];
+}
+
+static void sortGroup(tResultCols *g)
+{
+    int *order = (int *)malloc(sizeof(int) * g->n);
+    void *tmp = malloc(sizeof(sqlite3_int64) * g->n);
+
+    if (order == NULL || tmp == NULL)
+        pexit("sortGroup");
+
+    for (int i = 0; i < g->n; i++)
+        order[i] = i;
+
+    /* The rows are sorted through their positions, then every column is put in that order on its own. */
+    qsort_r(order, g->n, sizeof(int), compareRows, g);
+
+#define PERMUTE(col, type) \
+    do { \
+        type *t = (type *)tmp; \
+        for (int i = 0; i < g->n; i++) \
+            t[i] = g->col[order[i]]; \
+        memcpy(g->col, t, sizeof(type) * g->n); \
+    } while (0)
+
+    PERMUTE(time, double);
+    PERMUTE(length, int);
+    PERMUTE(mistakes, int);
+    PERMUTE(id, sqlite3_int64);
+
+#undef PERMUTE
+
+    free(order);
+    free(tmp);
+}
+
+static void *cacheLoader(void *arg)
+{
+    char *path = (char *)arg;
+    sqlite3 *rd = NULL;
+    sqlite3_stmt *res = NULL;
+    sqlite3_int64 maxId = 0;
+
+    /* WAL lets this connection read while the program keeps saving results through its own. */
+    if (sqlite3_open_v2(path, &rd, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK &&
+            sqlite3_prepare_v2(rd, "SELECT Fingers, Length, Mistakes, Time, Id FROM Records WHERE Fingers IS NOT NULL \
+                AND Length IS NOT NULL AND Mistakes IS NOT NULL AND Time IS NOT NULL;", -1, &res, 0) == SQLITE_OK)
+    {
+        while (sqlite3_step(res) == SQLITE_ROW)
+        {
+            sqlite3_int64 id = sqlite3_column_int64(res, 4);
+
+            addResult(id, (const char *)sqlite3_column_text(res, 0), sqlite3_column_int(res, 1),
+                    sqlite3_column_int(res, 2), sqlite3_column_double(res, 3), 0);
+            if (id > maxId)
+                maxId = id;
+        }
+    }
+
+    sqlite3_finalize(res);
+    sqlite3_close(rd);
+    free(path);
+    traceMark("results read");
+
+    for (int i = 0; i < ntests; i++)
+        for (int j = 0; j < tests[i]->ngroups; j++)
+            sortGroup(&tests[i]->groups[j]);
+
+    pthread_mutex_lock(&mutex);
+
+    /* The results saved during the load that it didn't see, oldest first. */
+    tPending *list = NULL;
+    while (pending)
+    {
+        tPending *p = pending;
+        pending = p->next;
+        p->next = list;
+        list = p;
+    }
+
+    lastTest = NULL;
+    while (list)
+    {
+        tPending *p = list;
+        list = p->next;
+
+        if (p->id > maxId)
+            addResult(p->id, p->name, p->length, p->mistakes, p->time, 1);
+        else
+        {
+            /* It was loaded already, it's still the last result added. */
+            lastTest = findTest(p->name, 0);
+            lastKey = group_key(p->name, p->length);
+            lastTime = p->time;
+        }
+
+        free(p->name);
+        free(p);
+    }
+
+    ready = 1;
+    pthread_mutex_unlock(&mutex);
+    traceMark("results cache loaded");
+
+    return NULL;
+}
+
+void cacheAdd(sqlite3_int64 id, const char *name, int length, int mistakes, double time)
+{
+    if (!started)
+        return;
+
+    pthread_mutex_lock(&mutex);
+
+    if (ready)
+        addResult(id, name, length, mistakes, time, 1);
+    else
+    {
+        tPending *p = (tPending *)malloc(sizeof(tPending));
+
+        if (p == NULL || (p->name = strdup(name)) == NULL)
+            pexit("cacheAdd");
+
+        p->id = id;
+        p->length = length;
+        p->mistakes = mistakes;
+        p->time = time;
+        p->next = pending;
+        pending = p;
+    }
+
+    pthread_mutex_unlock(&mutex);
+}
+
+const tTestCache *cacheTest(const char *name)
+{
+    return findTest(name, 0);
+}
+
+const tResultCols *cacheGroup(const tTestCache *t, int key)
+{
+    for (int i = 0; t && i < t->ngroups; i++)
+        if (t->groups[i].key == key)
+            return &t->groups[i];
+
+    return NULL;
+}
+
+int cacheTests(const tTestCache * const **list)
+{
+    *list = (const tTestCache * const *)tests;
+
+    return ntests;
+}
+
+void cacheRank(const tResultCols *g, double time, int *better, int *slower)
+{
+    int lo = 0, hi = g->n;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (g->time[mid] < time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *better = lo;
+
+    hi = g->n;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (g->time[mid] <= time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *slower = g->n - lo;
+}
+
+void cacheLast(const tTestCache **t, const tResultCols **g, double *time)
+{
+    *t = lastTest;
+    *g = cacheGroup(lastTest, lastKey);
+    *time = lastTime;
+}
@@ -0,0 +1,741 @@
+#include <screen_grid.h>
+#include <limits.h>
+#include <poll.h>
+
+/* Cursor moves shorter than this are replaced by rewriting the unchanged cells in between. */
+#define GAP_REWRITE 4
+/* Size of the buffer for escape sequences, when it fills up the part of the frame built so far is written. */
+#define ESC_SIZE 4096
+
+/* Local functions */
+
+/*
+ * Write every piece of the frame to the grid's fd, retrying after partial writes and interrupted calls. Once a non
+ * blocking grid has pending bytes the pieces are added after them, so the terminal gets the frame in order.
+ */
+static void gridFlush(tGrid *g);
+
+/*
+ * Copy the cnt pieces of iov after the pending bytes of the grid.
+ */
+static void gridPend(tGrid *g, const struct iovec *iov, int cnt);
+
+/*
+ * Append a piece of len bytes that points to s. The bytes are not copied so they must stay valid until the frame is
+ * written. A piece that continues the previous one just extends it.
+ */
+static void gridRef(tGrid *g, const char *s, int len);
+
+/*
+ * Copy len bytes of s to the escape buffer of the grid and append them to the frame.
+ */
+static void gridPut(tGrid *g, const char *s, int len);
+
+/*
+ * Append the cell x of the back grid row y, straight from the row's render buffer when possible.
+ */
+static void gridCell(tGrid *g, int y, int x);
+
+/*
+ * Append the sequence that moves the cursor from (*cy, *cx) to (y, x), nothing is written if it's already there.
+ */
+static void gridMove(tGrid *g, int *cy, int *cx, int y, int x);
+
+/*
+ * Append the SGR sequence that changes the current attributes *cur into attr.
+ */
+static void gridAttr(tGrid *g, unsigned char *cur, unsigned char attr);
+
+/*
+ * Return the cell that refers to the cluster of len bytes at s, adding it to the cluster table if it isn't there.
+ */
+static unsigned int gridCluster(tGrid *g, const char *s, int len);
+
+/*
+ * Fill the back grid row y with the cells of the visible row that belongs to it.
+ */
+static void composeRow(tGrid *g, termAttributes *T, int y);
+
+/*
+ * Fill the cells of a row that isn't plain ASCII, walking it by grapheme clusters from the column coloff. Returns the
+ * number of cells filled.
+ */
+static int composeUtf8(tGrid *g, const tRow *row, int coloff, tCell *cell);
+
+/*
+ * Fill the back grid row y with the app message, the SGR color codes of the message become cell attributes.
+ */
+static void composeMessage(tGrid *g, const char *msg, int y);
+
+/*
+ * Compare the row y of the back grid with the front grid, and append the sequences that bring the terminal up to date.
+ * Returns the number of cells that changed.
+ */
+static int diffRow(tGrid *g, int y, int *cy, int *cx, unsigned char *attr);
+
+static void gridPend(tGrid *g, const struct iovec *iov, int cnt)
+{
+    for (; cnt > 0; iov++, cnt--)
+    {
+        if (g->pendlen + (int)iov->iov_len > g->pendcap)
+        {
+            g->pendcap = 2 * (g->pendlen + iov->iov_len);
+            g->pend = (char *)realloc(g->pend, g->pendcap);
+
+            if (g->pend == 0)
+                pexit("gridPend");
+        }
+
+        memcpy(&g->pend[g->pendlen], iov->iov_base, iov->iov_len);
+        g->pendlen += iov->iov_len;
+    }
+}
+
+static void gridFlush(tGrid *g)
+{
+    struct iovec *iov = g->iov;
+    int cnt = g->iovcnt;
+
+    /* An earlier part of the frame is still waiting, writing now would get ahead of it. */
+    if (g->pendlen > 0)
+    {
+        gridPend(g, iov, cnt);
+        cnt = 0;
+    }
+
+    while (cnt > 0)
+    {
+        ssize_t n = writev(g->fd, iov, cnt);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && g->nonblock)
+            {
+                /* Keep the rest of the frame, the caller writes it with gridDrain when fd is ready again. */
+                gridPend(g, iov, cnt);
+                break;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                struct pollfd pfd = {g->fd, POLLOUT, 0};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+
+            /* The terminal is gone, there is nobody left to show the frame to. */
+            g->written = -1;
+            break;
+        }
+
+        if (g->written >= 0)
+            g->written += n;
+
+        /* Skip the pieces that were written completely and advance inside the one that wasn't. */
+        while (cnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+
+        if (cnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    g->iovcnt = 0;
+    g->esclen = 0;
+}
+
+static void gridRef(tGrid *g, const char *s, int len)
+{
+    if (len <= 0)
+        return;
+
+    if (g->iovcnt)
+    {
+        struct iovec *last = &g->iov[g->iovcnt - 1];
+        if ((const char *)last->iov_base + last->iov_len == s)
+        {
+            last->iov_len += len;
+            return;
+        }
+    }
+
+    if (g->iovcnt == g->iovcap)
+        gridFlush(g);
+
+    g->iov[g->iovcnt].iov_base = (void *)s;
+    g->iov[g->iovcnt].iov_len = len;
+    g->iovcnt++;
+}
+
+static void gridPut(tGrid *g, const char *s, int len)
+{
+    /* Pieces already point inside esc, so it can't be reallocated. Write them out instead. */
+    if (g->esclen + len > g->esccap)
+        gridFlush(g);
+
+    memcpy(&g->esc[g->esclen], s, len);
+    gridRef(g, &g->esc[g->esclen], len);
+    g->esclen += len;
+}
+
+static void gridCell(tGrid *g, int y, int x)
+{
+    tCell *cell = &g->back[y * g->cols + x];
+
+    if (g->src[y] && !(cell->attr & CELL_REVERSE))
+    {
+        gridRef(g, &g->src[y][x], 1);
+    }
+    else if (cell->ch == CELL_WIDE)
+    {
+        /* The first column of the character already covered this one. */
+    }
+    else if (CELL_IS_CLUSTER(cell->ch))
+    {
+        tCluster *c = &g->clusters[cell->ch >> 8];
+        gridPut(g, c->bytes, c->len);
+    }
+    else
+    {
+        char buf[4];
+        int len = utf8Length(cell->ch & 0xff);
+
+        for (int i = 0; i < len; i++)
+            buf[i] = cell->ch >> (8 * i);
+
+        gridPut(g, buf, len);
+    }
+}
+
+static void gridMove(tGrid *g, int *cy, int *cx, int y, int x)
+{
+    char buf[32];
+    int len;
+
+    if (*cy == y && *cx == x)
+        return;
+
+    if (*cy == y && *cx >= 0 && x > *cx)
+        len = snprintf(buf, sizeof(buf), "\x1b[%dC", x - *cx);
+    else
+        len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+
+    gridPut(g, buf, len);
+    *cy = y;
+    *cx = x;
+}
+
+static void gridAttr(tGrid *g, unsigned char *cur, unsigned char attr)
+{
+    char buf[32];
+    int len = 2;
+
+    if (*cur == attr)
+        return;
+
+    memcpy(buf, "\x1b[", 2);
+    if ((*cur ^ attr) & CELL_REVERSE)
+        len += snprintf(&buf[len], sizeof(buf) - len, "%s", (attr & CELL_REVERSE) ? "7" : "27");
+
+    if ((*cur ^ attr) & ~CELL_REVERSE)
+    {
+        int fg = attr & ~CELL_REVERSE;
+        len += snprintf(&buf[len], sizeof(buf) - len, "%s%d", len > 2 ? ";" : "", fg ? fg : 39);
+    }
+
+    buf[len++] = 'm';
+    gridPut(g, buf, len);
+    *cur = attr;
+}
+
+void gridResize(tGrid *g, int rows, int cols)
+{
+    if (rows < 0)
+        rows = 0;
+    if (cols < 0)
+        cols = 0;
+
+    g->rows = rows;
+    g->cols = cols;
+
+    free(g->front);
+    free(g->back);
+    free(g->flen);
+    free(g->src);
+
+    g->front = (tCell *)malloc(sizeof(tCell) * rows * cols + 1);
+    g->back = (tCell *)malloc(sizeof(tCell) * rows * cols + 1);
+    g->flen = (int *)malloc(sizeof(int) * rows + 1);
+    g->src = (const char **)calloc(rows + 1, sizeof(char *));
+
+    if (g->front == 0 || g->back == 0 || g->flen == 0 || g->src == 0)
+        pexit("gridResize");
+
+    if (g->iov == NULL)
+    {
+        g->iovcap = IOV_MAX;
+        g->iov = (struct iovec *)malloc(sizeof(struct iovec) * g->iovcap);
+        g->esccap = ESC_SIZE;
+        g->esc = (char *)malloc(g->esccap);
+
+        if (g->iov == 0 || g->esc == 0)
+            pexit("gridResize");
+    }
+
+    gridInvalidate(g);
+}
+
+void gridInvalidate(tGrid *g)
+{
+    /* A zero character never comes out of composeRow, so every cell will be seen as changed. */
+    for (int i = 0; i < g->rows * g->cols; i++)
+    {
+        g->front[i].ch = 0;
+        g->front[i].attr = 0;
+    }
+
+    for (int y = 0; y < g->rows; y++)
+        g->flen[y] = g->cols;
+
+    g->lastcy = -1;
+    g->lastcx = -1;
+}
+
+int gridDrain(tGrid *g, int fd)
+{
+    while (g->pendlen)
+    {
+        ssize_t n = write(fd, g->pend, g->pendlen);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            return -1;
+        }
+
+        memmove(g->pend, &g->pend[n], g->pendlen - n);
+        g->pendlen -= n;
+    }
+
+    return g->pendlen;
+}
+
+void gridFree(tGrid *g)
+{
+    free(g->pend);
+    g->pend = NULL;
+    g->pendlen = g->pendcap = 0;
+
+    free(g->clusters);
+    g->clusters = NULL;
+    g->nclusters = g->clustercap = 0;
+
+    free(g->front);
+    free(g->back);
+    free(g->flen);
+    free(g->src);
+    free(g->iov);
+    free(g->esc);
+
+    g->front = NULL;
+    g->back = NULL;
+    g->flen = NULL;
+    g->src = NULL;
+    g->iov = NULL;
+    g->esc = NULL;
+    g->iovcnt = g->iovcap = 0;
+    g->esclen = g->esccap = 0;
+    g->rows = 0;
+    g->cols = 0;
+}
+
+static unsigned int gridCluster(tGrid *g, const char *s, int len)
+{
+    unsigned int h = 2166136261u;
+
+    for (int i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+
+    for (h &= g->clustercap - 1; g->clusters[h].len; h = (h + 1) & (g->clustercap - 1))
+        if (g->clusters[h].len == len && memcmp(g->clusters[h].bytes, s, len) == 0)
+            return CELL_CLUSTER(h);
+
+    g->clusters[h].len = len;
+    memcpy(g->clusters[h].bytes, s, len);
+    g->nclusters++;
+
+    return CELL_CLUSTER(h);
+}
+
+static int composeUtf8(tGrid *g, const tRow *row, int coloff, tCell *cell)
+{
+    const char *s = row->render;
+    int i = 0;
+    int col = 0;
+    int x = 0;
+
+    /*
+     * A row adds at most cols clusters, so the table is kept at most half full. When it's emptied the front grid
+     * can't be trusted anymore, its cells may refer to clusters that are gone.
+     */
+    if (g->clustercap < 4 * g->cols || g->nclusters + g->cols > g->clustercap / 2)
+    {
+        if (g->clustercap < 4 * g->cols)
+        {
+            free(g->clusters);
+            for (g->clustercap = 256; g->clustercap < 4 * g->cols; g->clustercap *= 2);
+            g->clusters = (tCluster *)malloc(sizeof(tCluster) * g->clustercap);
+
+            if (g->clusters == 0)
+                pexit("composeUtf8");
+        }
+
+        for (int j = 0; j < g->clustercap; j++)
+            g->clusters[j].len = 0;
+
+        g->nclusters = 0;
+        gridInvalidate(g);
+    }
+
+    while (i < row->rsize && x < g->cols)
+    {
+        int width;
+        unsigned int cp;
+        unsigned int ch = 0;
+        unsigned char attr = 0;
+        int len = utf8Cluster(&s[i], row->rsize - i, &width, &cp);
+
+        if (cp == UTF8_INVALID || (cp >= 0x80 && cp < 0xa0))
+        {
+            ch = '?';
+            attr = CELL_REVERSE;
+        }
+        else if (cp < 0x20 || cp == 0x7f)
+        {
+            ch = (cp <= 26) ? '@' + cp : '?';
+            attr = CELL_REVERSE;
+        }
+        else if (len == utf8Length(s[i]))
+        {
+            for (int j = 0; j < len; j++)
+                ch |= (unsigned int)(unsigned char)s[i + j] << (8 * j);
+        }
+        else
+        {
+            ch = gridCluster(g, &s[i], len);
+        }
+        i += len;
+
+        if (col + width <= coloff)
+        {
+            col += width;
+            continue;
+        }
+
+        /* A wide character cut by the left edge or by the right one is shown as blanks. */
+        if (col < coloff || x + width > g->cols)
+        {
+            for (int j = col < coloff ? col + width - coloff : width; j > 0 && x < g->cols; j--, x++)
+            {
+                cell[x].ch = ' ';
+                cell[x].attr = 0;
+            }
+            col += width;
+            continue;
+        }
+        col += width;
+
+        cell[x].ch = ch;
+        cell[x].attr = attr;
+        x++;
+
+        if (width == 2)
+        {
+            cell[x].ch = CELL_WIDE;
+            cell[x].attr = attr;
+            x++;
+        }
+    }
+
+    return x;
+}
+
+static void composeRow(tGrid *g, termAttributes *T, int y)
+{
+    tCell *cell = &g->back[y * g->cols];
+    int filtRow = y + T->rowoff;
+    int x = 0;
+
+    g->src[y] = NULL;
+    if (filtRow >= T->numrows)
+    {
+        if (g->cols)
+        {
+            cell[0].ch = '~';
+            cell[0].attr = 0;
+            x = 1;
+        }
+    }
+    else if (!T->row[filtRow].ascii)
+    {
+        x = composeUtf8(g, &T->row[filtRow], T->coloff, cell);
+    }
+    else
+    {
+        int len = T->row[filtRow].rsize - T->coloff;
+        if (len < 0)
+            len = 0;
+        if (len > g->cols)
+            len = g->cols;
+
+        unsigned char *c = (unsigned char *)&T->row[filtRow].render[T->coloff];
+        g->src[y] = (char *)c;
+        for (; x < len; x++)
+        {
+            if (iscntrl(c[x]))
+            {
+                cell[x].ch = (c[x] <= 26) ? '@' + c[x] : '?';
+                cell[x].attr = CELL_REVERSE;
+            }
+            else
+            {
+                cell[x].ch = c[x];
+                cell[x].attr = 0;
+            }
+        }
+    }
+
+    for (; x < g->cols; x++)
+    {
+        cell[x].ch = ' ';
+        cell[x].attr = 0;
+    }
+}
+
+static void composeMessage(tGrid *g, const char *msg, int y)
+{
+    tCell *cell = &g->back[y * g->cols];
+    unsigned char attr = 0;
+    int x = 0;
+
+    g->src[y] = NULL;
+    /* The message stops at the first newline just like before. */
+    while (*msg && *msg != '\n' && x < g->cols)
+    {
+        if (msg[0] == '\x1b' && msg[1] == '[')
+        {
+            int param = 0;
+            msg += 2;
+
+            while (*msg)
+            {
+                if (*msg >= '0' && *msg <= '9')
+                {
+                    param = 10 * param + *msg - '0';
+                }
+                else if (*msg == ';' || *msg == 'm')
+                {
+                    if (param == 0)
+                        attr = 0;
+                    else if (param == 7)
+                        attr |= CELL_REVERSE;
+                    else if (param == 27)
+                        attr &= ~CELL_REVERSE;
+                    else if (param == 39)
+                        attr &= CELL_REVERSE;
+                    else if ((param >= 30 && param <= 37) || (param >= 90 && param <= 97))
+                        attr = (attr & CELL_REVERSE) | param;
+
+                    param = 0;
+                    if (*msg == 'm')
+                    {
+                        msg++;
+                        break;
+                    }
+                }
+                else
+                {
+                    /* Not an SGR sequence, drop it. */
+                    msg++;
+                    break;
+                }
+                msg++;
+            }
+            continue;
+        }
+
+        /* Messages are plain ASCII, any other character is shown as a single placeholder. */
+        if (!iscntrl((unsigned char)*msg) && (*msg & 0xc0) != 0x80)
+        {
+            cell[x].ch = (unsigned char)*msg < 0x80 ? *msg : '?';
+            cell[x].attr = attr;
+            x++;
+        }
+        msg++;
+    }
+
+    for (; x < g->cols; x++)
+    {
+        cell[x].ch = ' ';
+        cell[x].attr = 0;
+    }
+}
+
+static int diffRow(tGrid *g, int y, int *cy, int *cx, unsigned char *attr)
+{
+    tCell *back = &g->back[y * g->cols];
+    tCell *front = &g->front[y * g->cols];
+    int changed = 0;
+    int blen = g->cols;
+    int x = 0;
+
+    /* Trailing blanks are cleared with one erase sequence instead of being written. */
+    while (blen > 0 && back[blen - 1].ch == ' ' && back[blen - 1].attr == 0)
+        blen--;
+
+    while (x < blen)
+    {
+        if (back[x].ch == front[x].ch && back[x].attr == front[x].attr)
+        {
+            x++;
+            continue;
+        }
+
+        /* The second column of a wide character is written by its first one. */
+        if (back[x].ch == CELL_WIDE && x > 0)
+            x--;
+
+        gridMove(g, cy, cx, y, x);
+
+        while (x < blen)
+        {
+            if (back[x].ch == front[x].ch && back[x].attr == front[x].attr)
+            {
+                /* Rewrite a short unchanged gap with the same attributes, it's cheaper than moving the cursor. */
+                int gap = 0;
+                while (x + gap < blen && gap < GAP_REWRITE &&
+                        back[x + gap].ch == front[x + gap].ch && back[x + gap].attr == front[x + gap].attr &&
+                        back[x + gap].attr == *attr)
+                    gap++;
+
+                if (gap == GAP_REWRITE || x + gap == blen ||
+                        (back[x + gap].ch == front[x + gap].ch && back[x + gap].attr == front[x + gap].attr))
+                    break;
+
+                for (int i = 0; i < gap; i++)
+                    gridCell(g, y, x + i);
+
+                x += gap;
+                *cx += gap;
+                continue;
+            }
+
+            gridAttr(g, attr, back[x].attr);
+            gridCell(g, y, x);
+            front[x] = back[x];
+            changed++;
+            x++;
+            (*cx)++;
+
+            if (x < g->cols && back[x].ch == CELL_WIDE)
+            {
+                front[x] = back[x];
+                x++;
+                (*cx)++;
+            }
+
+            /* Writing over the first column of a wide character blanks its second one on the terminal. */
+            if (x < g->cols && front[x].ch == CELL_WIDE)
+                front[x].ch = 0;
+        }
+
+        /* After writing the last column the terminal may hold the cursor in a pending wrap state. */
+        if (*cx >= g->cols)
+            *cy = *cx = -1;
+    }
+
+    if (g->flen[y] > blen)
+    {
+        gridMove(g, cy, cx, y, blen);
+        gridAttr(g, attr, 0);
+        gridRef(g, "\x1b[K", 3);
+
+        for (x = blen; x < g->cols; x++)
+        {
+            front[x].ch = ' ';
+            front[x].attr = 0;
+        }
+        changed++;
+    }
+    g->flen[y] = blen;
+
+    return changed;
+}
+
+int gridRender(tGrid *g, termAttributes *T, int fd)
+{
+    /* The rows after the visible rows belong to the status bar thread, the app message comes after them. */
+    int rows = T->screenrows + T->boardrows + 2;
+    int cy = -1, cx = -1;
+    unsigned char attr = 0;
+    int changed = 0;
+    char buf[32];
+
+    if (g->pendlen)
+        return 0;
+
+    if (g->rows != rows || g->cols != T->screencols)
+        gridResize(g, rows, T->screencols);
+
+    g->fd = fd;
+    g->written = 0;
+    g->iovcnt = 0;
+    g->esclen = 0;
+    gridRef(g, "\x1b[?2026h\x1b[?25l", 14);
+
+    for (int y = 0; y < T->screenrows; y++)
+    {
+        composeRow(g, T, y);
+        changed += diffRow(g, y, &cy, &cx, &attr);
+    }
+
+    composeMessage(g, T->appmsg, rows - 1);
+    changed += diffRow(g, rows - 1, &cy, &cx, &attr);
+
+    int targety = T->cy - T->rowoff;
+    int targetx = T->rx - T->coloff;
+
+    /* Nothing changed and the cursor stays where it was, so there is no need to write anything. */
+    if (!changed && g->lastcy == targety && g->lastcx == targetx)
+    {
+        g->iovcnt = 0;
+        return 0;
+    }
+
+    gridAttr(g, &attr, 0);
+
+    /* Move the cursor to the position indicated by E.cx and E.cy subtracting their respective offsets. */
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", targety + 1, targetx + 1);
+    gridPut(g, buf, len);
+    gridRef(g, "\x1b[?25h\x1b[?2026l", 14);
+
+    g->lastcy = targety;
+    g->lastcx = targetx;
+
+    gridFlush(g);
+    return g->written;
+}
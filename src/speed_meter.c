@@ -0,0 +1,107 @@
+#include <speed_meter.h>
+#include <time.h>
+
+/* Microseconds in a minute multiplied by 100, so the speeds come out in hundredths of CPM. */
+#define CPM_SCALE 6000000000LL
+/* The moving average gives every new interval a weight of 1 / 2^EWMA_SHIFT. */
+#define EWMA_SHIFT 3
+
+/* Static variables */
+/* Upper limits (in hundredths of CPM) of the speed bands and their colors. */
+static const struct
+{
+    long limit;
+    int color;
+} bands[] = {{20000, 31},   /* RED */
+    {30000, 33},            /* YELLOW */
+    {40000, 32},            /* GREEN */
+    {50000, 34},            /* BLUE */
+    {60000, 35},            /* MAGENTA */
+    {70000, 36}};           /* CYAN */
+
+long long speedNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void speedStart(tSpeed *s, long long ts)
+{
+    s->first = ts;
+    s->last = ts;
+    s->windowSum = 0;
+    s->head = 0;
+    s->filled = 0;
+    s->keys = 1;
+    s->ewma = 0;
+}
+
+void speedKey(tSpeed *s, long long ts)
+{
+    long long interval = ts - s->last;
+
+    if (interval < 0)
+        interval = 0;
+
+    /* Replace the oldest interval of the ring. */
+    if (s->filled == SPEED_WINDOW)
+        s->windowSum -= s->ring[s->head];
+    else
+        s->filled++;
+
+    s->ring[s->head] = interval;
+    s->windowSum += interval;
+    s->head = (s->head + 1) % SPEED_WINDOW;
+
+    if (s->keys == 1)
+        s->ewma = interval << 8;
+    else
+        s->ewma += ((interval << 8) - s->ewma) >> EWMA_SHIFT;
+
+    s->last = ts;
+    s->keys++;
+}
+
+long speedInstant(const tSpeed *s)
+{
+    if (s->windowSum <= 0)
+        return 0;
+
+    return s->filled * CPM_SCALE / s->windowSum;
+}
+
+long speedCumulative(const tSpeed *s)
+{
+    long long elapsed = s->last - s->first;
+
+    if (elapsed <= 0)
+        return 0;
+
+    /* The first key only starts the clock, so it isn't counted. */
+    return (s->keys - 1) * CPM_SCALE / elapsed;
+}
+
+long speedEwma(const tSpeed *s)
+{
+    if (s->ewma <= 0)
+        return 0;
+
+    return (CPM_SCALE << 8) / s->ewma;
+}
+
+long long speedElapsed(const tSpeed *s)
+{
+    return s->last - s->first;
+}
+
+int speedColor(long cpm)
+{
+    for (int i = 0; i < sizeof(bands) / sizeof(bands[0]); i++)
+        if (cpm <= bands[i].limit)
+            return bands[i].color;
+
+    /* BRIGHT RED */
+    return 91;
+}
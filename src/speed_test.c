@@ -1,39 +1,47 @@
 #include <speed_test.h>
 
 #define CTRL_KEY(k) ((k) & 0x1f)
+/* Size of the passage of a corpus that the drill takes its words from. */
+#define DRILL_SOURCE_LENGTH 65536
 
 /* Static variables */
-static char *Global_Ar[] = {"qw",
-    "as",
-    "zx",
-    "op",
-    "l;",
-    "./"};
-
 
 /* Test length for the 2 fingers test. */
 static int G_Test_Length;
 /* Will point to the converted file to characters */
 static char *buffer = NULL;
+/* Corpus index the custom test passages are taken from, NULL if a single file was given. */
+static tCorpus *corpus = NULL;
 /* Entry name for the sqlite db. */
 static char *test_name = NULL;
 /* Custom struct to store attributes of the current terminal session. */
 static termAttributes *sh_Attrs;
+/* Latencies of the keys typed in the current test, they are saved to the database when the test finishes. */
+static tKeyLog key_log = KEYLOG_INIT;
+/* Generator of the adaptive drills, it's built from the custom test's text the first time a drill is requested. */
+static tDrill drill;
+static int drill_ready = 0;
+/* Race this process takes part in, NULL when it isn't racing. */
+static tRace *race = NULL;
+/* Drills of the auto test, see setDrills(). */
+static tFingerDrills *drills = NULL;
+/* Keys each menu takes, built once when the menu is first shown. */
+static tKeySet menu_keys;
+static tKeySet db_keys;
+/* Characters of each result of the marathon, see setMarathon(). */
+static int marathon_checkpoint = MARATHON_CHECKPOINT;
 
 /* Function declarations */
 
 /*
- * Checks whether the character c belongs to Global_Ar, in that case the function returns 1 , *idx contains the
- * index of char in the static array, and ptr is used to change the value of a char * to show the beginning of that
- * string.
+ * Draws the row-th racer of the race board in buf, with a progress bar as wide as size allows.
  */
-static int checkValidKey(char c, char *idx, char** ptr);
+static void drawRace(int row, char *buf, int size);
 
 /*
- * Returns a string containing the possible values for id. This is used to filter the availabe keys for the different
- * menus (id is the menu's name).
+ * Leaves the race when the program exits.
  */
-static char *getListFromId(char *id);
+static void leaveRace(void);
 
 /*
  * Uses getchar but converts the char to lower and returns it.
@@ -41,9 +49,11 @@ static char *getListFromId(char *id);
 static int l_getchar(void);
 
 /*
- * Check whether char c belongs to the list returned from getListFromId(id).
+ * Uses getKey but the enter key gives '\n', so keys can be compared directly with the normalized text of the custom
+ * test. A key that starts a UTF-8 sequence is read with the rest of its bytes, so seq holds a whole code point. Keys
+ * that aren't bytes, like the arrows, are skipped. Returns the number of bytes in seq.
  */
-static int notValidChar(char c, char *id);
+static int textKey(char *seq);
 
 /*
  * Menu to perform some sql queries (get best and average times) in the sqlite db.
@@ -62,20 +72,142 @@ static void custom_test(char *test, char *test_name);
  */
 static void typingTest(void);
 
+/*
+ * Generates a drill from the words of the custom test's text that contain the user's slowest bigrams and runs it as
+ * a custom test.
+ */
+static void drillTest(void);
+
+/*
+ * Types the text of the custom test, or of the corpus, without end: it's cut into chunks of a row that are taken as
+ * they are needed, and a result is saved every marathon_checkpoint characters. Only the chunk being typed and the
+ * next one are kept, so the memory used doesn't grow however long it lasts.
+ */
+static void marathonTest(void);
+
+/*
+ * Copies to dst the next chunk of the size bytes of text, starting at *pos, and moves *pos after it. The chunk takes
+ * at most cols columns plus a space at its end, and room bytes. Line endings become spaces, the text starts over
+ * after its end, and words are only split when they are wider than a chunk. dst[-1] has to be the byte before the
+ * chunk, so there is never a space after another. Returns the length of the chunk, 0 if the text has nothing but
+ * spaces.
+ */
+static int marathonChunk(const char *text, size_t size, size_t *pos, char *dst, int room, int cols);
+
+/*
+ * Shows the status of the marathon and its two chunks from row line onwards, the cursor is left where the chunk is
+ * typed.
+ */
+static void drawMarathon(int line, const char *status, const char *chunk, const char *next);
+
+/*
+ * Saves the latencies of the test that just finished, and feeds them to the drill generator.
+ */
+static void saveKeyLog(void);
+
+/*
+ * Shows the speed of the last keys and the average speed measured by s in the app message. The color comes from the
+ * speed band of the moving average, so it doesn't flicker with every key.
+ */
+static void showSpeed(tSpeed *s);
+
+/*
+ * Shows where the result just saved ranks among the results of its test.
+ */
+static void showRank(void);
+
+static void showRank(void)
+{
+    int rank, slower, total;
+
+    if (get_last_rank(&rank, &slower, &total))
+        return;
+
+    char *message;
+    asprintf(&message, "\nThis time ranks %d of %d for this test, faster than %d%% of the others", rank,
+            total, total > 1 ? slower * 100 / (total - 1) : 100);
+    dumpRows(message, 0, sh_Attrs->numrows);
+    free(message);
+}
+
+static void saveKeyLog(void)
+{
+    save_key_stats(&key_log);
+
+    if (drill_ready)
+        drillUpdate(&drill, key_log.ev, key_log.n);
+}
+
+static void drillTest(void)
+{
+    /* The words of a large random passage stand in for the whole corpus. */
+    if (NULL == buffer && corpus)
+    {
+        buffer = corpusPassage(corpus, DRILL_SOURCE_LENGTH, ((uint64_t)rand() << 31) ^ rand());
+        forCleanup(buffer);
+    }
+
+    if (NULL == buffer)
+    {
+        dumpRows("The drill picks its words from the custom test's text, but no custom test was given.\n", 0,
+                sh_Attrs->numrows);
+        sleep(1);
+        return;
+    }
+
+    if (!drill_ready)
+    {
+        tKeyStat *stats;
+        int n;
+
+        if (drillInit(&drill, buffer))
+        {
+            dumpRows("The custom test's text has no words to drill.\n", 0, sh_Attrs->numrows);
+            sleep(1);
+            return;
+        }
+
+        if (load_key_stats(&stats, &n) == 0)
+            drillSetStats(&drill, stats, n);
+
+        free(stats);
+        drill_ready = 1;
+    }
+
+    char *text = drillGenerate(&drill, G_Test_Length);
+    custom_test(text, "drill");
+    free(text);
+}
+
+static void showSpeed(tSpeed *s)
+{
+    if (s->keys < 2)
+    {
+        setAppMessage("\x1b[37mWhen you start typing this will line will show your CPM");
+        return;
+    }
+
+    long now = speedInstant(s);
+    long avg = speedCumulative(s);
+
+    setAppMessage("\x1b[%dmYour current CPM is : %ld.%02ld (average %ld.%02ld)", speedColor(speedEwma(s)),
+            now / 100, now % 100, avg / 100, avg % 100);
+}
 
 static void typingTest(void)
 {
     char c;
-    /* Ptr to the character in character tuple to be tested */
-    char *ptr;
-    /* Index of the character (0 or 1) */
-    char idx;
-    struct timeval end, start, result;
+    /* The drill started by the first key. */
+    tFingerDrill *d = NULL;
+    tSession session;
     int repeat;
     char *message = 0;
     char *test_message = 0;
-    float test_time;
-    float cpm = 0;
+    /* The keys the test expects, the pair alternates starting with the key that began the test. */
+    char *text = (char *)malloc(G_Test_Length + 2);
+
+    if (text == 0)
+        pexit("typingTest");
 
     asprintf(&test_message, "Type as fast as you can %u letters:\n", G_Test_Length);
     forCleanup(test_message);
@@ -84,19 +216,23 @@ static void typingTest(void)
 
     do
     {
-        /* The number of mistakes */
-        int mistakes = 0;
         repeat = 0;
 START:
         setAppMessage("\x1b[37mWhen you start typing this will line will show your CPM");
         delRows(test_offset);
         while ((c = l_getchar()))
         {
-            if (checkValidKey(c, &idx, &ptr))
+            if ((d = fingerDrillFind(drills, (unsigned char)c)))
             {
+                /* Each key of the drill gives the next one, so the test goes on from the key it started with. */
+                text[0] = c;
+                for (int i = 1; i <= G_Test_Length; i++)
+                    text[i] = d->next[(unsigned char)text[i - 1]];
+                text[G_Test_Length + 1] = '\0';
+
+                sessionInit(&session, text, G_Test_Length + 1, &key_log);
+                sessionKey(&session, &c, 1, speedNow());
                 insertChar(c);
-
-                gettimeofday(&start, NULL);
                 break;
             }
 
@@ -105,54 +241,23 @@ START:
                 delRows(test_offset);
                 dumpRows("Exiting test...", 0, sh_Attrs->numrows);
                 sleep(1);
+                free(text);
                 return;
             }
         }
 
-        for (int i = 1; i < G_Test_Length + 1; i++)
+        while (!sessionDone(&session))
         {
-            int colorCode = 0;
-
-            gettimeofday(&end, NULL);
-            timersub(&end, &start, &result);
-            test_time = result.tv_sec + (float)result.tv_usec / 1000000;
-            cpm = i / test_time * 60;
-
-            if (cpm <= 200.0)
-                /* RED */
-                colorCode = 31;
-            else if (cpm <= 300.0)
-                /* YELLOW */
-                colorCode = 33;
-            else if (cpm <= 400.0)
-                /* GREEN */
-                colorCode = 32;
-            else if (cpm <= 500.0)
-                /* BLUE */
-                colorCode = 34;
-            else if (cpm <= 600)
-                /* MAGENTA */
-                colorCode = 35;
-            else if (cpm <= 700)
-                /* CYAN */
-                colorCode = 36;
-            else
-               /* BRIGHT RED */
-               colorCode = 91;
-
-
-            setAppMessage("\x1b[%dmYour current CPM is : %.2f", colorCode, cpm);
+            showSpeed(&session.speed);
 
             /* Case isn't important for this test. */
             c = l_getchar();
-            if (c != ptr[!idx]) {
-                i--;
-                mistakes++;
+            if (sessionKey(&session, &c, 1, speedNow()) == CORE_MISTAKE)
+            {
                 if (CTRL('r') == c)
                 {
                     delRows(test_offset);
                     dumpRows("Resetting...", 0, sh_Attrs->numrows);
-                    mistakes = 0;
                     sleep(1);
                     goto START;
                 }
@@ -161,24 +266,28 @@ START:
                     delRows(test_offset);
                     dumpRows("Exiting test...", 0, sh_Attrs->numrows);
                     sleep(1);
+                    free(text);
                     return;
                 }
             }
             else
             {
-                idx = !idx;
                 insertChar(c);
             }
 
         }
 
-        asprintf(&message, "Your CPM was %.2f", cpm);
+        long cpm = speedCumulative(&session.speed);
+        long long elapsed = speedElapsed(&session.speed);
+        asprintf(&message, "Your CPM was %ld.%02ld", cpm / 100, cpm % 100);
         dumpRows(message, 0, sh_Attrs->numrows);
         free(message);
 
-        insert(ptr, G_Test_Length, mistakes, result.tv_sec + (float)result.tv_usec / 1000000);
-        asprintf(&message, "\nYou finished in %lu.%06lu seconds \nYou made %d mistakes\nRepeat the test? (y\\n)\n",
-                result.tv_sec, result.tv_usec, mistakes);
+        insert(d->name, G_Test_Length, session.mistakes, elapsed / 1000000.0);
+        saveKeyLog();
+        showRank();
+        asprintf(&message, "\nYou finished in %lld.%06lld seconds \nYou made %d mistakes\nRepeat the test? (y\\n)\n",
+                elapsed / 1000000, elapsed % 1000000, session.mistakes);
         dumpRows(message, 0, sh_Attrs->numrows);
         free(message);
 
@@ -190,6 +299,8 @@ START:
             repeat = 0;
 
     } while (repeat);
+
+    free(text);
 }
 
 /* Make it work with scrolling maybe calculate the availabe screen and split it in two
@@ -197,7 +308,10 @@ START:
 static void custom_test(char *test, char *test_name)
 {
     char c;
-    struct timeval end, start, result;
+    /* The key typed, whole code points are compared with the text. */
+    char seq[4];
+    int n;
+    tSession session;
     int repeat;
 
     char *test_message = 0;
@@ -214,24 +328,20 @@ static void custom_test(char *test, char *test_name)
 
     do
     {
-        /* The number of mistakes */
-        int mistakes = 0;
-        int idx = 0;
-        float test_time = 0;
-        float cpm = 0;
         repeat = 0;
 START:
-        idx = 0;
         delRows(test_offset - 7);
         size_read = reset_size;
         setAppMessage("\x1b[37mWhen you start typing this will line will show your CPM");
         dumpRows(test_message, 4, sh_Attrs->numrows);
         dumpRows("\n**************************************************\n\n", 0, sh_Attrs->numrows);
 
-        mistakes = 0;
+        sessionInit(&session, test, strlen(test), &key_log);
+        if (race)
+            racePublish(race, 0, session.len, 0, 0);
 
-        while ((c = getKey()) != test[0])
-            if (CTRL_KEY('b') == c)
+        while ((n = textKey(seq)) && sessionKey(&session, seq, n, speedNow()) == CORE_IGNORED)
+            if (CTRL_KEY('b') == seq[0])
             {
                 delRows(test_offset);
                 dumpRows("Exiting test...", 0, sh_Attrs->numrows);
@@ -239,47 +349,20 @@ START:
                 return;
             }
 
-        insertChar(c);
-        gettimeofday(&start, NULL);
-        idx++;
+        insertText(seq, n);
 
-        while (test[idx])
+        while (!sessionDone(&session))
         {
-            int colorCode = 0;
-
-            gettimeofday(&end, NULL);
-            timersub(&end, &start, &result);
-            test_time = result.tv_sec + (float)result.tv_usec / 1000000;
-            cpm = idx / test_time * 60;
-
-            if (cpm <= 200.0)
-                /* RED */
-                colorCode = 31;
-            else if (cpm <= 300.0)
-                /* YELLOW */
-                colorCode = 33;
-            else if (cpm <= 400.0)
-                /* GREEN */
-                colorCode = 32;
-            else if (cpm <= 500.0)
-                /* BLUE */
-                colorCode = 34;
-            else if (cpm <= 600)
-                /* MAGENTA */
-                colorCode = 35;
-            else if (cpm <= 700)
-                /* CYAN */
-                colorCode = 36;
-            else
-               /* BRIGHT RED */
-               colorCode = 91;
+            showSpeed(&session.speed);
+            n = textKey(seq);
+            c = seq[0];
+            int result = sessionKey(&session, seq, n, speedNow());
 
-            setAppMessage("\x1b[%dmYour current CPM is : %.2f", colorCode, cpm);
-            c = getKey();
-            if (c != test[idx] && (c != '\r' || test[idx] != '\n'))
-            {
-                mistakes++;
+            if (race)
+                racePublish(race, session.idx, session.len, session.mistakes, speedCumulative(&session.speed));
 
+            if (result == CORE_MISTAKE)
+            {
                 if (CTRL_KEY('r') == c)
                 {
                     delRows(test_offset);
@@ -295,39 +378,38 @@ START:
                     return;
                 }
             }
+            else if (c == '\n')
+            {
+                delRow(test_offset - 6);
+                size_read += dumpRows(test_message + size_read, 1, test_offset - 4);
+                delRows(test_offset);
+            }
             else
             {
-                if (c == '\r')
+                int temp = sh_Attrs->cy;
+                insertText(seq, n);
+                if (sh_Attrs->cy != temp)
                 {
+                    delRow(sh_Attrs->numrows - 2);
                     delRow(test_offset - 6);
                     size_read += dumpRows(test_message + size_read, 1, test_offset - 4);
-                    delRows(test_offset);
                 }
-                else
-                {
-                    int temp = sh_Attrs->cy;
-                    insertChar(c);
-                    if (sh_Attrs->cy != temp)
-                    {
-                        delRow(sh_Attrs->numrows - 2);
-                        delRow(test_offset - 6);
-                        size_read += dumpRows(test_message + size_read, 1, test_offset - 4);
-                    }
-                }
-                idx++;
             }
         }
 
-        int test_length = strlen(test);
-        insert(test_name, test_length, mistakes, test_time);
+        long cpm = speedCumulative(&session.speed);
+        long long elapsed = speedElapsed(&session.speed);
+        insert(test_name, session.len, session.mistakes, elapsed / 1000000.0);
+        saveKeyLog();
 
         char *message;
-        asprintf(&message, "Your CPM was %.2f", cpm);
+        asprintf(&message, "Your CPM was %ld.%02ld", cpm / 100, cpm % 100);
         dumpRows(message, 0, sh_Attrs->numrows);
         free(message);
+        showRank();
 
-        asprintf(&message, "\nYou finished in %lu.%06lu seconds \nYou made %d mistakes\nRepeat the test? (y\\n)\n",
-                result.tv_sec, result.tv_usec, mistakes);
+        asprintf(&message, "\nYou finished in %lld.%06lld seconds \nYou made %d mistakes\nRepeat the test? (y\\n)\n",
+                elapsed / 1000000, elapsed % 1000000, session.mistakes);
         dumpRows(message, 0, sh_Attrs->numrows);
         free(message);
 
@@ -341,18 +423,208 @@ START:
     } while (repeat);
 }
 
-static int checkValidKey(char c, char *idx, char** ptr)
+static int marathonChunk(const char *text, size_t size, size_t *pos, char *dst, int room, int cols)
 {
-    for (int i = 0; i < sizeof(Global_Ar) / sizeof(Global_Ar[0]); i++)
-        for (int j = 0; j < 2; j++)
-            if (c == Global_Ar[i][j])
+    int len = 0, width = 0;
+    /* Where the chunk ends if it's cut after its last space. */
+    int cut = 0;
+    size_t cutPos = *pos;
+    int full = 0;
+
+    /* The 0 byte after the text is its last line ending. */
+    for (size_t walked = 0; walked <= size;)
+    {
+        if (*pos > size)
+            *pos = 0;
+
+        char c = text[*pos];
+        int n = 1, w = 1;
+
+        if (c == '\n' || c == '\t' || c == '\0')
+            c = ' ';
+
+        if (c == ' ')
+        {
+            if ((len ? dst[len - 1] : dst[-1]) == ' ')
             {
-                *idx = j;
-                *ptr = Global_Ar[i];
-                return 1;
+                (*pos)++;
+                walked++;
+                continue;
             }
+        }
+        else
+        {
+            unsigned int cp;
+            n = utf8Cluster(&text[*pos], size - *pos, &w, &cp);
+        }
 
-    return 0;
+        /* A chunk has at least a character, so there is always something to type. */
+        if (len + n > room || (c != ' ' && len && width + w > cols))
+        {
+            full = 1;
+            break;
+        }
+
+        if (c == ' ')
+            dst[len] = ' ';
+        else
+            memcpy(&dst[len], &text[*pos], n);
+
+        len += n;
+        width += w;
+        *pos += n;
+        walked += n;
+
+        if (c == ' ')
+        {
+            cut = len;
+            cutPos = *pos;
+        }
+    }
+
+    if (full && cut && cut < len)
+    {
+        len = cut;
+        *pos = cutPos;
+    }
+
+    dst[len] = '\0';
+
+    return len;
+}
+
+static void drawMarathon(int line, const char *status, const char *chunk, const char *next)
+{
+    char *message = 0;
+
+    asprintf(&message, "%s\n%s\n%s\n\n**************************************************\n\n", status, chunk, next);
+    delRows(line);
+    dumpRows(message, 0, line);
+    free(message);
+}
+
+static void marathonTest(void)
+{
+    const char *text = corpus ? corpus->text : buffer;
+    size_t size = corpus ? corpus->hdr->textSize : (buffer ? strlen(buffer) : 0);
+    size_t pos = 0;
+
+    if (NULL == text)
+        pexit("No custom test was given\n");
+
+    /* A corpus is read on from a random sentence, a file from its start. */
+    if (corpus && corpus->hdr->nsentences)
+        pos = corpus->sentences[(((uint64_t)rand() << 31) ^ rand()) % corpus->hdr->nsentences];
+    /* A damaged index can point past the text, its start is read then. */
+    if (pos >= size)
+        pos = 0;
+
+    /* The chunk and the space after it fit in a row that insertText() doesn't wrap. */
+    int cols = sh_Attrs->screencols - 3;
+    int room = (cols > 0 ? cols : 1) * UTF8_CLUSTER_MAX;
+    /* The chunk being typed and the next one, each after the byte that comes before it. */
+    char *window[2];
+    int len[2];
+    int cur = 0;
+
+    window[0] = (char *)malloc(room + 2);
+    window[1] = (char *)malloc(room + 2);
+    if (window[0] == NULL || window[1] == NULL)
+        pexit("marathonTest");
+
+    window[0][0] = ' ';
+    len[0] = marathonChunk(text, size, &pos, window[0] + 1, room, cols);
+    window[1][0] = window[0][len[0]];
+    len[1] = marathonChunk(text, size, &pos, window[1] + 1, room, cols);
+
+    if (len[0] == 0)
+    {
+        free(window[0]);
+        free(window[1]);
+        pexit("The custom test has nothing to type\n");
+    }
+
+    char *message = 0;
+    asprintf(&message, "Marathon of %s, a result is saved every %d characters. Type Ctrl-B to stop.\n", test_name,
+            marathon_checkpoint);
+    dumpRows(message, 0, sh_Attrs->numrows);
+    free(message);
+    int test_offset = sh_Attrs->numrows;
+
+    char status[128] = "Type the first line to start";
+    char seq[4];
+    int n;
+    tSession session;
+    /* Characters typed in all and since the last result, and the time they took without the breaks. */
+    long typed = 0;
+    int saved = 0;
+    int cpTyped = 0;
+    int cpMistakes = 0;
+    long long cpTime = 0;
+    long long last = 0;
+    /* Speed of the last result. */
+    long cpm = 0;
+
+    setAppMessage("\x1b[37mWhen you start typing this will line will show your CPM");
+    drawMarathon(test_offset, status, window[cur] + 1, window[!cur] + 1);
+    sessionInit(&session, window[cur] + 1, len[cur], &key_log);
+
+    while ((n = textKey(seq)) && CTRL_KEY('b') != seq[0])
+    {
+        long long now = speedNow();
+        int result = sessionKey(&session, seq, n, now);
+
+        if (result == CORE_IGNORED || result == CORE_MISTAKE)
+            continue;
+
+        insertText(seq, n);
+        showSpeed(&session.speed);
+
+        if (last && now - last < MARATHON_BREAK_US)
+            cpTime += now - last;
+        last = now;
+        typed += n;
+        cpTyped += n;
+
+        if (cpTyped >= marathon_checkpoint)
+        {
+            insert(test_name, cpTyped, session.mistakes - cpMistakes, cpTime / 1000000.0);
+            saveKeyLog();
+            keyLogReset(&key_log);
+
+            cpm = cpTime ? cpTyped * 6000000000LL / cpTime : 0;
+            saved++;
+            cpMistakes = session.mistakes;
+            cpTyped = 0;
+            cpTime = 0;
+        }
+
+        if (result == CORE_FINISH)
+        {
+            /* The next chunk is typed, and the one after it is taken in the buffer of the chunk just typed. */
+            cur = !cur;
+            sessionNext(&session, window[cur] + 1, len[cur]);
+            window[!cur][0] = window[cur][len[cur]];
+            len[!cur] = marathonChunk(text, size, &pos, window[!cur] + 1, room, cols);
+            if (saved)
+                snprintf(status, sizeof(status), "%ld characters typed, %d results saved, the last one at %ld.%02ld CPM",
+                        typed, saved, cpm / 100, cpm % 100);
+            else
+                snprintf(status, sizeof(status), "%ld characters typed", typed);
+            drawMarathon(test_offset, status, window[cur] + 1, window[!cur] + 1);
+        }
+    }
+
+    /* The keys after the last result still count for the statistics of the keys. */
+    if (key_log.n)
+        saveKeyLog();
+
+    free(window[0]);
+    free(window[1]);
+
+    delRows(test_offset);
+    dumpRows("Exiting marathon...", 0, sh_Attrs->numrows);
+    sleep(1);
 }
 
 int convertInput(char* input)
@@ -379,9 +651,29 @@ static int l_getchar(void)
     return c;
 }
 
+static int textKey(char *seq)
+{
+    int c;
+
+    /* Keys like the arrows come after the range of a byte, cut to a char they would look like a UTF-8 lead byte. */
+    while ((c = getKey()) >= 256)
+        ;
+
+    if (c == '\r')
+        c = '\n';
+
+    int len = utf8Length((unsigned char)c);
+
+    seq[0] = c;
+    for (int i = 1; i < len; i++)
+        seq[i] = getKey();
+
+    return len;
+}
+
 int goto_Menu(void)
 {
-    char c;
+    int c;
     static int init = 0;
     static int test_offset = 0;
 
@@ -389,6 +681,8 @@ int goto_Menu(void)
     char *Menu = "##################################################\n"
         "Type enter or tab to enter the auto test.\n"
         "Type c to enter the custom test.\n"
+        "Type m to type the custom test without end.\n"
+        "Type d to drill the bigrams you type slowest.\n"
         "Type b to browse the database.\n"
         "Type q to quit the applications.\n"
         "##################################################\n";
@@ -396,9 +690,14 @@ int goto_Menu(void)
 
     if (init == 0)
     {
+        keySetInit(&menu_keys, "\t\rqbcdm");
+        keySetInit(&db_keys, "123456x");
         enableRawMode();
+        traceMark("raw mode");
         sh_Attrs = initShellAttributes();
+        traceMark("window size");
         dumpRows(Menu, 0, sh_Attrs->numrows);
+        traceMark("menu laid out");
         init = 1;
         test_offset = sh_Attrs->numrows;
     }
@@ -407,11 +706,26 @@ int goto_Menu(void)
         delRows(test_offset);
     }
 
-    while (notValidChar(c = getKey(), "Menu"));
+    do
+        c = getKey();
+    while (!KEY_SET_HAS(&menu_keys, c));
 
     switch(c)
     {
         case 'c':
+            if (corpus)
+            {
+                /* Every racer has to type the same passage. */
+                uint64_t r = race ? race->seed : ((uint64_t)rand() << 31) ^ rand();
+                char *passage = corpusPassage(corpus, G_Test_Length, r);
+                if (NULL == passage)
+                    pexit("The corpus has no text\n");
+
+                custom_test(passage, test_name);
+                free(passage);
+                return 1;
+            }
+
             if (NULL == buffer)
                 pexit("No custom test was given\n");
             custom_test(buffer, test_name);
@@ -422,6 +736,12 @@ int goto_Menu(void)
         case '\t':
             typingTest();
             return 1;
+        case 'd':
+            drillTest();
+            return 1;
+        case 'm':
+            marathonTest();
+            return 1;
         case 'q':
             return 0;
         case 'b':
@@ -437,9 +757,12 @@ static void browse_DB(void)
 {
     int c;
     int stay = 1;
-    char *menu = "Type 1 to fetch the fastest times\n"
+    char *menu = "Type 1 to browse the fastest times\n"
         "Type 2 to browse average times\n"
         "Type 3 to get statistics for all tests\n"
+        "Type 4 to see your slowest keys and bigrams\n"
+        "Type 5 to see the percentiles of a test's times\n"
+        "Type 6 to see the trend of a test's speed\n"
         "Type x to exit the DB menu\n"
         "##################################################\n";
 
@@ -449,7 +772,9 @@ static void browse_DB(void)
 
     while (stay)
     {
-        while (notValidChar(c = l_getchar(), "DB"));
+        do
+            c = l_getchar();
+        while (!KEY_SET_HAS(&db_keys, c));
 
         int cnt = 0;
         switch(c)
@@ -463,17 +788,29 @@ static void browse_DB(void)
                 }
 
                 test_name[cnt] = 0;
-                dumpRows("How many results to fetch (0-9)?\n", 0, sh_Attrs->numrows);
+                dumpRows("How many results to fetch? (Enter fetches them all)\n", 0, sh_Attrs->numrows);
 
-                while ((c = getKey()) < 48 && c > 58);
-                insertChar(c);
+                int limit = 0;
+                while ((c = getKey()) != '\r')
+                    if (c >= '0' && c <= '9' && limit < PAGE_LIMIT_MAX / 10)
+                    {
+                        insertChar(c);
+                        limit = limit * 10 + c - '0';
+                    }
 
-                if (get_nmin(test_name, G_Test_Length, c ))
-                    init_sqlite_db();
+                /* The header, the page and the help line fill the screen. */
+                tPager pager;
+                int page_line = sh_Attrs->numrows;
+                open_pager(&pager, test_name, G_Test_Length, sh_Attrs->screenrows - 3, limit);
+                page_results(&pager, PAGE_FIRST, page_line);
 
-                dumpRows("Press Enter to return", 0, sh_Attrs->numrows);
                 while ((c = getKey()) != '\r')
-                    moveCursor(c);
+                {
+                    if (PAGE_DOWN == c || PAGE_UP == c)
+                        page_results(&pager, PAGE_DOWN == c ? PAGE_NEXT : PAGE_PREV, page_line);
+                    else
+                        moveCursor(c);
+                }
                 break;
 
             case '2' :
@@ -492,15 +829,9 @@ static void browse_DB(void)
                 while ((c = l_getchar()) != 'y' && c != 'n');
 
                 if ('n' == c)
-                {
-                    if (get_average(test_name, G_Test_Length))
-                        init_sqlite_db();
-                }
+                    get_average(test_name, G_Test_Length);
                 else
-                {
-                    if (get_all_averages(test_name))
-                        init_sqlite_db();
-                }
+                    get_all_averages(test_name);
 
                 dumpRows("Press Enter to return", 0, sh_Attrs->numrows);
                 while ((c = getKey()) != '\r')
@@ -508,54 +839,69 @@ static void browse_DB(void)
                 break;
 
             case '3':
-                if (get_all_averages(0))
-                    init_sqlite_db();
+                get_all_averages(0);
 
                 dumpRows("Press Enter to return", 0, sh_Attrs->numrows);
                 while ((c = getKey()) != '\r')
                     moveCursor(c);
                 break;
 
-            case 'x' :
-                stay = 0;
+            case '4':
+                get_slowest_keys(10);
+
+                dumpRows("Press Enter to return", 0, sh_Attrs->numrows);
+                while ((c = getKey()) != '\r')
+                    moveCursor(c);
                 break;
-        }
 
-        delRows(menu_end);
-    }
+            case '5':
+                dumpRows("Which test to browse? (Enter alone for every drill)\n", 0, sh_Attrs->numrows);
+                while ((c = getKey()) != '\r' && cnt < 20)
+                {
+                    insertChar(c);
+                    test_name[cnt++] = c;
+                }
 
-}
+                test_name[cnt] = 0;
+                dumpRows("\n", 0, sh_Attrs->numrows);
+                get_percentiles(test_name, G_Test_Length);
 
-static int notValidChar(char c, char *id)
-{
-    char *validChars;
-    int idx = 0;
-    validChars = getListFromId(id);
+                dumpRows("Press Enter to return", 0, sh_Attrs->numrows);
+                while ((c = getKey()) != '\r')
+                    moveCursor(c);
+                break;
 
-    while (validChars[idx])
-    {
-        if ((c == validChars[idx++]))
-            return 0;
-    }
+            case '6':
+                dumpRows("Which test to browse?\n", 0, sh_Attrs->numrows);
+                while ((c = getKey()) != '\r' && cnt < 20)
+                {
+                    insertChar(c);
+                    test_name[cnt++] = c;
+                }
 
-    return 1;
-}
+                test_name[cnt] = 0;
+                dumpRows("Per day or per week? (d/w)\n", 0, sh_Attrs->numrows);
 
-static char *getListFromId(char *id)
-{
-    static char *list[][2] ={{"DB","123x"},
-        {"Menu","\t\rqbc"} };
+                while ((c = l_getchar()) != 'd' && c != 'w');
 
-    for (int i = 0; i < sizeof(list) / sizeof(list[0]); i++)
-    {
-        if (strcmp(list[i][0], id) == 0)
-            return list[i][1];
+                dumpRows("\n", 0, sh_Attrs->numrows);
+                get_trend(test_name, 'w' == c, sh_Attrs->screencols - 2);
+
+                dumpRows("Press Enter to return", 0, sh_Attrs->numrows);
+                while ((c = getKey()) != '\r')
+                    moveCursor(c);
+                break;
+
+            case 'x' :
+                stay = 0;
+                break;
+        }
+
+        delRows(menu_end);
     }
 
-    return 0;
 }
 
-
 char *fileToBuffer(char *filename)
 {
     FILE *f = fopen(filename, "rb");
@@ -571,10 +917,13 @@ char *fileToBuffer(char *filename)
     fseek(f, 0, SEEK_SET);
 
     char *string = (char *)malloc(fsize + 1);
-    fread(string, fsize, 1, f);
-    string[fsize] = 0;
+    fsize = fread(string, 1, fsize, f);
     fclose(f);
 
+    /* The test compares keys with the text as it is, so line endings, tabs and control characters are cleaned. */
+    fsize = textNormalize(string, string, fsize);
+    string[fsize] = 0;
+
     return string;
 }
 
@@ -593,3 +942,101 @@ void setAttributes(int testLength, char *testName, char *fileBuffer)
     }
 
 }
+
+void setDrills(tFingerDrills *d)
+{
+    drills = d;
+    set_finger_tests(d);
+}
+
+void setMarathon(int checkpoint)
+{
+    marathon_checkpoint = checkpoint;
+}
+
+void setRace(tRace *r)
+{
+    race = r;
+    setStatusBoard(RACE_SLOTS, drawRace);
+    atexit(leaveRace);
+}
+
+static void leaveRace(void)
+{
+    raceLeave(race);
+}
+
+static void drawRace(int row, char *buf, int size)
+{
+    tRaceState st;
+
+    if (!raceRead(race, row, &st))
+    {
+        buf[0] = '\0';
+        return;
+    }
+
+    /* Name, bar, percentage, speed and mistakes, the bar gets whatever is left. */
+    char bar[256];
+    int width = size - RACE_NAME_SIZE - 36;
+    if (width > (int)sizeof(bar) - 1)
+        width = sizeof(bar) - 1;
+    if (width < 1)
+        width = 1;
+
+    int done = st.len ? (long long)st.pos * width / st.len : 0;
+    int percent = st.len ? (long long)st.pos * 100 / st.len : 0;
+    for (int i = 0; i < width; i++)
+        bar[i] = i < done ? '#' : '.';
+    bar[width] = '\0';
+
+    snprintf(buf, size + 64, "%c%-*s [\x1b[%dm%s\x1b[m] %3d%% %5ld.%02ld CPM %3d mistakes", row == race->slot ? '>' : ' ',
+            RACE_NAME_SIZE - 1, st.player, speedColor(st.cpm), bar, percent, st.cpm / 100, st.cpm % 100, st.mistakes);
+}
+
+void setCorpus(tCorpus *c)
+{
+    corpus = c;
+    srand(time(NULL) ^ getpid());
+}
+
+int benchCore(long events)
+{
+    static const char words[] = "the quick brown fox jumps over the lazy dog ";
+    char text[BENCH_TEXT_LENGTH];
+    tKeyLog log = KEYLOG_INIT;
+    tSession session;
+    long long ts = 0;
+    long tests = 0;
+    long mistakes = 0;
+
+    for (int i = 0; i < BENCH_TEXT_LENGTH; i++)
+        text[i] = words[i % (sizeof(words) - 1)];
+
+    sessionInit(&session, text, BENCH_TEXT_LENGTH, &log);
+    long long start = speedNow();
+
+    for (long i = 0; i < events; i++)
+    {
+        /* A wrong key every now and then, and intervals that vary like a real typist's do. */
+        char key = (i % 37 == 36) ? '#' : text[session.idx];
+        ts += 80 + (i & 63);
+
+        if (sessionKey(&session, &key, 1, ts) == CORE_FINISH)
+        {
+            mistakes += session.mistakes;
+            tests++;
+            sessionReset(&session);
+        }
+    }
+
+    long long elapsed = speedNow() - start;
+    if (elapsed <= 0)
+        elapsed = 1;
+
+    printf("%ld events in %lld.%06lld seconds: %.1f million events per second (%ld tests, %ld mistakes)\n",
+            events, elapsed / 1000000, elapsed % 1000000, (double)events / elapsed, tests, mistakes);
+    keyLogFree(&log);
+
+    return 0;
+}
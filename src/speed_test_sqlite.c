@@ -1,232 +1,1639 @@
 #include <speed_test_sqlite.h>
+#include <results_cache.h>
+#include <quantile_sketch.h>
+#include <startup_trace.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* Type definitios */
+
+/*
+ * Result of a query, it's shown all at once by tableDump() with the values of every row in a column. Each cell is
+ * its name then its value, both followed by a 0 byte, and a '\n' byte ends each row.
+ */
+typedef struct tTable
+{
+    char *cells;
+    size_t size;
+    size_t cap;
+    /* Longest name of a cell, and the bytes the shown table takes without the padding of the names. */
+    int nameWidth;
+    int cellCount;
+    size_t textSize;
+} tTable;
+
+#define TABLE_INIT {NULL, 0, 0, 0, 0, 0}
 
 /* Static functions. */
 static void deinitSQLite(void);
 
-/* Static variables. */
-static termAttributes *sh_Attrs;
-static sqlite3 *db;
+/*
+ * Adds the len bytes at s to the cells of t.
+ */
+static void tableAppend(tTable *t, const char *s, size_t len);
+
+/*
+ * Adds a row of argc cells to t, a NULL value is shown as NULL.
+ */
+static void tableRow(tTable *t, int argc, char **argv, char **names);
+
+/*
+ * Adds every row of the prepared query res to t, the way callback() does for sqlite3_exec(). res is finalized.
+ * Returns SQLITE_OK or the error of the query.
+ */
+static int tableQuery(tTable *t, sqlite3_stmt *res);
+
+/*
+ * Shows every row of t, each cell in a line with its name padded so the values are aligned, and a blank line after
+ * each row. The text is built in a single buffer and inserted at once. t is emptied.
+ */
+static void tableDump(tTable *t);
+
+/*
+ * Returns the path of the database: the one given to set_db_path(), $TWOFINGERS_DB, or DB_FILE in the XDG data
+ * directory, which is created if it's missing. The string is allocated.
+ */
+static char *dbPath(void);
+
+/*
+ * Shows the error of the last operation on the connection, prefixed by what.
+ */
+static void dbError(const char *what);
+
+/*
+ * Opens the database and brings it up to date. On error *message is set to why (allocated) and there is no
+ * connection.
+ */
+static int openDb(char **message);
+
+/*
+ * Opens the database in the thread started by start_sqlite_db(), then starts loading the results cache.
+ */
+static void *openerThread(void *arg);
+
+/*
+ * Waits for the database opened by start_sqlite_db(), and shows why it failed if it did. Returns 1 when there is no
+ * database. It's called by every function that uses it.
+ */
+static int waitDb(void);
+
+/*
+ * Brings the schema of the database up to the last of the migrations.
+ */
+static int migrate(void);
+
+/*
+ * SQL function digest_merge(a, b): the digest of the values of the blob digests a and b. A NULL or damaged digest is
+ * empty.
+ */
+static void sqlDigestMerge(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+
+/*
+ * SQL aggregate digest(x): the digest of every value x that isn't NULL, or NULL.
+ */
+static void sqlDigestStep(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+static void sqlDigestFinal(sqlite3_context *ctx);
+
+/*
+ * Makes the digest d the result of the SQL function ctx.
+ */
+static void sqlDigestResult(sqlite3_context *ctx, const tDigest *d);
+
+/*
+ * Adds a result of the test Fingers to the sketches of its times and speeds, in C so the schema needs no function of
+ * this program. Returns 0 or the sqlite error.
+ */
+static int sketchAdd(const char *Fingers, int Length, double time);
+
+/*
+ * Returns 1 if Fingers is the name of one of the drills of the auto test, the default 2finger tests unless
+ * set_finger_tests() was called.
+ */
+static int isFingerTest(const char *Fingers);
+
+/*
+ * Key of the group of results a result of the test name is compared with: its length for the 2finger tests, 0 for
+ * the others.
+ */
+static int groupKey(const char *name, int length);
+
+/*
+ * Writes x in buf (32 bytes) the way sqlite shows ROUND(x, 2), and returns buf.
+ */
+static char *roundText(double x, char *buf);
+
+/*
+ * get_average() and get_all_averages() served from the results cache, their output is the same.
+ */
+static void cacheAverage(char *Fingers, int Length);
+static void cacheAllAverages(char *Fingers);
+
+/*
+ * Returns the line of the result browser for a result at position pos.
+ */
+static char *pageLine(int pos, const char *name, int length, int mistakes, double t);
+
+/*
+ * Read the page of page_results() from the query res, or from the results cache. Each row is stored in lines and
+ * key like page_results() expects, the number of rows is returned.
+ */
+static int sqlPage(tPager *p, sqlite3_stmt *res, int dir, int pos, int size, char **lines, tPageKey *key);
+static int cachePage(tPager *p, int dir, int pos, int size, char **lines, tPageKey *key);
+
+/* Defines */
+
+/* SQL expression that shows the character x, with whitespace control characters escaped. */
+#define KEY_LABEL(x) "'''' || replace(replace(replace(" x ", char(10), '\\n'), char(13), '\\r'), char(9), '\\t') || ''''"
+/*
+ * SQL expression that shows the logged byte x. A byte of a multibyte UTF-8 character isn't a character by itself, it's
+ * shown in hex. It's meant for the format of asprintf(), which turns the %% into %.
+ */
+#define KEY_BYTE(x) "CASE WHEN (" x ") >= 128 THEN printf('\\x%%02X', " x ") ELSE char(" x ") END"
+
+/*
+ * Adds each result to the totals of its day and of its week as it's saved, a period starts on its first day in local
+ * time and a week on monday. The bulk inserts drop it while they run and add their rows with rollup_sql instead.
+ */
+#define ROLLUP_TRIGGER "CREATE TRIGGER IF NOT EXISTS RecordsRollup AFTER INSERT ON Records " \
+        "WHEN NEW.StartedAt IS NOT NULL AND NEW.Fingers IS NOT NULL AND NEW.Time IS NOT NULL BEGIN " \
+        "INSERT INTO DailyStats VALUES(NEW.Fingers, date(NEW.StartedAt, 'unixepoch', 'localtime'), 1, " \
+            "IFNULL(NEW.Length, 0), IFNULL(NEW.Mistakes, 0), NEW.Time) " \
+            "ON CONFLICT(Fingers, Start) DO UPDATE SET Tests = Tests + 1, Length = Length + excluded.Length, " \
+            "Mistakes = Mistakes + excluded.Mistakes, Time = Time + excluded.Time; " \
+        "INSERT INTO WeeklyStats VALUES(NEW.Fingers, date(NEW.StartedAt, 'unixepoch', 'localtime', '-6 days', " \
+            "'weekday 1'), 1, IFNULL(NEW.Length, 0), IFNULL(NEW.Mistakes, 0), NEW.Time) " \
+            "ON CONFLICT(Fingers, Start) DO UPDATE SET Tests = Tests + 1, Length = Length + excluded.Length, " \
+            "Mistakes = Mistakes + excluded.Mistakes, Time = Time + excluded.Time; " \
+        "END;"
+
+/*
+ * Changes of the schema, the i-th one takes the database from user_version i to i + 1. The tables themselves are
+ * created before them, so a database made before the versions existed starts at 0 like a new one.
+ */
+static const char *migrations[] = {
+    /*
+     * The result browser and the rank queries read a test ordered by time. The length is in the index so the
+     * 2finger tests are filtered without reading the table, an index leading with it would make every insert
+     * twice as slow.
+     */
+    "DROP INDEX IF EXISTS RecordsByTime; CREATE INDEX IF NOT EXISTS RecordsByTest ON Records(Fingers, Time, Length);",
+    /*
+     * When each test started, in seconds since the epoch (NULL for the results saved before), and the totals of every
+     * test per day and per week. The trigger keeps the totals as the results are saved, a period starts on its first
+     * day in local time and a week on monday. The index only has the dated results, it's what the retention deletes.
+     */
+    "ALTER TABLE Records ADD COLUMN StartedAt INTEGER;"
+    "CREATE INDEX IF NOT EXISTS RecordsByStart ON Records(StartedAt) WHERE StartedAt IS NOT NULL;"
+    "CREATE TABLE IF NOT EXISTS DailyStats(Fingers TEXT, Start TEXT, Tests INT, Length INT, Mistakes INT, Time REAL, "
+        "PRIMARY KEY(Fingers, Start)) WITHOUT ROWID;"
+    "CREATE TABLE IF NOT EXISTS WeeklyStats(Fingers TEXT, Start TEXT, Tests INT, Length INT, Mistakes INT, Time REAL, "
+        "PRIMARY KEY(Fingers, Start)) WITHOUT ROWID;"
+    "CREATE TABLE IF NOT EXISTS Settings(Name TEXT PRIMARY KEY, Value);"
+    ROLLUP_TRIGGER,
+    /*
+     * Digests of the times and of the speeds of every test and length (see quantile_sketch.h), the percentiles are
+     * read from them. insert() and end_bulk_insert() add the results to them, so the results other programs add
+     * aren't in them. Like the daily and weekly totals they keep the results the retention deletes.
+     */
+    "CREATE TABLE IF NOT EXISTS Sketches(Fingers TEXT, Length INT, Times BLOB, Cpm BLOB, PRIMARY KEY(Fingers, Length));"
+    "INSERT OR REPLACE INTO Sketches SELECT Fingers, IFNULL(Length, 0), digest(Time), "
+        "digest(IFNULL(Length, 0) * 60.0 / Time) FROM Records WHERE Fingers IS NOT NULL AND Time > 0 "
+        "GROUP BY Fingers, IFNULL(Length, 0);",
+};
+
+/*
+ * Deletes the dated results older than the days of the RetentionDays setting, nothing when it isn't set or it's 0.
+ * They were added to the daily and weekly totals when they were saved, so only the totals are left of them.
+ */
+static const char *retention_sql = "DELETE FROM Records WHERE StartedAt IS NOT NULL AND StartedAt < "
+    "CAST(strftime('%s', 'now') AS INTEGER) - 86400 * "
+    "(SELECT Value FROM Settings WHERE Name = 'RetentionDays' AND Value > 0);";
+
+/*
+ * What ROLLUP_TRIGGER does, for every result after the Id ?1 at once: one row per test and period instead of one
+ * upsert per result. The local day of each result is found once, its week is found from the day.
+ */
+static const char *rollup_sql = "CREATE TEMP TABLE IF NOT EXISTS BulkDays(Fingers TEXT, Start TEXT, Tests INT, "
+        "Length INT, Mistakes INT, Time REAL);"
+    "DELETE FROM temp.BulkDays;"
+    "INSERT INTO temp.BulkDays SELECT Fingers, date(StartedAt, 'unixepoch', 'localtime'), COUNT(*), "
+        "SUM(IFNULL(Length, 0)), SUM(IFNULL(Mistakes, 0)), SUM(Time) FROM Records "
+        "WHERE Id > ?1 AND StartedAt IS NOT NULL AND Fingers IS NOT NULL AND Time IS NOT NULL GROUP BY 1, 2;"
+    "INSERT INTO DailyStats SELECT * FROM temp.BulkDays WHERE 1 "
+        "ON CONFLICT(Fingers, Start) DO UPDATE SET Tests = Tests + excluded.Tests, Length = Length + excluded.Length, "
+        "Mistakes = Mistakes + excluded.Mistakes, Time = Time + excluded.Time;"
+    "INSERT INTO WeeklyStats SELECT Fingers, date(Start, '-6 days', 'weekday 1'), SUM(Tests), SUM(Length), "
+        "SUM(Mistakes), SUM(Time) FROM temp.BulkDays GROUP BY 1, 2 "
+        "ON CONFLICT(Fingers, Start) DO UPDATE SET Tests = Tests + excluded.Tests, Length = Length + excluded.Length, "
+        "Mistakes = Mistakes + excluded.Mistakes, Time = Time + excluded.Time;";
+
+/*
+ * Adds every result after the Id ?1 to the sketches at once, a digest of them merged into the one of each test and
+ * length.
+ */
+static const char *sketch_sql = "INSERT INTO Sketches SELECT Fingers, IFNULL(Length, 0), digest(Time), "
+        "digest(IFNULL(Length, 0) * 60.0 / Time) FROM Records WHERE Id > ?1 AND Fingers IS NOT NULL AND Time > 0 "
+        "GROUP BY 1, 2 ON CONFLICT(Fingers, Length) DO UPDATE SET Times = digest_merge(Times, excluded.Times), "
+        "Cpm = digest_merge(Cpm, excluded.Cpm);";
+
+/* Static variables. */
+static termAttributes *sh_Attrs;
+static sqlite3 *db;
+static const char *db_path = NULL;
+/* Path of the database opened. */
+static char *db_file = NULL;
+/* Drills of the auto test, see set_finger_tests(). */
+static const tFingerDrills *finger_tests = NULL;
+/* The thread opening the database, while opening is set, and why it failed if it did. */
+static pthread_t opener;
+static int opening = 0;
+static char *open_error = NULL;
+/* Id of the last result before the bulk insert running, see begin_bulk_insert(). */
+static sqlite3_int64 bulk_after = 0;
+/* Id of the last result of insert(), the sketches change the last rowid of the connection. */
+static sqlite3_int64 last_id = 0;
+
+void set_db_path(const char *path)
+{
+    db_path = path;
+}
+
+static char *dbPath(void)
+{
+    char *path = 0;
+    const char *env = getenv("TWOFINGERS_DB");
+
+    if (db_path)
+        return strdup(db_path);
+    if (env && env[0])
+        return strdup(env);
+
+    const char *data = getenv("XDG_DATA_HOME");
+    const char *home = getenv("HOME");
+
+    if (data && data[0] == '/')
+        asprintf(&path, "%s/" DB_DIR "/" DB_FILE, data);
+    else if (home && home[0])
+        asprintf(&path, "%s/.local/share/" DB_DIR "/" DB_FILE, home);
+    else
+        return strdup(DB_FILE);
+
+    /* Create every missing directory of the path, like mkdir -p. */
+    for (char *c = strchr(path + 1, '/'); c; c = strchr(c + 1, '/'))
+    {
+        *c = '\0';
+        mkdir(path, 0700);
+        *c = '/';
+    }
+
+    return path;
+}
+
+static void dbError(const char *what)
+{
+    char *message = 0;
+    asprintf(&message, "%s: %s\n", what, sqlite3_errmsg(db));
+    dumpRows(message, 0, sh_Attrs->numrows);
+    free(message);
+}
+
+/*
+ * This funtion needs to be called before sqlite operations.
+ * It initializes the db and sh_Attrs pointers. The connection stays open until the program exits, so calling it
+ * again does nothing. If start_sqlite_db() is opening it, it waits for it.
+ */
+int init_sqlite_db(void)
+{
+    sh_Attrs = getTermAttributes();
+
+    if (opening)
+        return waitDb();
+    if (db)
+        return 0;
+
+    char *message = 0;
+    if (openDb(&message))
+    {
+        dumpRows(message, 0, sh_Attrs->numrows);
+        free(message);
+
+        return 1;
+    }
+
+    atexit(deinitSQLite);
+    return 0;
+}
+
+void start_sqlite_db(void)
+{
+    sh_Attrs = getTermAttributes();
+
+    if (db || opening)
+        return;
+
+    /* It's registered here so the exit waits for the thread before closing what it opened. */
+    atexit(deinitSQLite);
+
+    opening = 1;
+    if (pthread_create(&opener, NULL, openerThread, NULL))
+        pexit("start_sqlite_db");
+}
+
+static void *openerThread(void *arg)
+{
+    traceMark("database thread started");
+
+    if (openDb(&open_error) == 0)
+        cacheStart(db_file, groupKey);
+
+    return arg;
+}
+
+static int waitDb(void)
+{
+    if (opening)
+    {
+        pthread_join(opener, NULL);
+        opening = 0;
+        traceMark("database waited for");
+
+        if (open_error)
+        {
+            dumpRows(open_error, 0, sh_Attrs->numrows);
+            free(open_error);
+            open_error = NULL;
+        }
+    }
+
+    return db == NULL;
+}
+
+static int openDb(char **message)
+{
+    db_file = dbPath();
+    int rc = sqlite3_open(db_file, &db);
+
+    if (rc != SQLITE_OK)
+    {
+        asprintf(message, "Cannot open database: %s\n", sqlite3_errmsg(db));
+        /* A handle is returned even when the open fails, it's of no use. */
+        sqlite3_close(db);
+        db = NULL;
+
+        return 1;
+    }
+
+    traceMark("database opened");
+
+    /*
+     * WAL lets readers and a writer work at the same time, and with synchronous=NORMAL a commit only appends to the
+     * log: the fsync happens at checkpoints. Another instance holding the write lock makes us wait up to
+     * DB_BUSY_TIMEOUT instead of failing with "database is locked".
+     */
+    sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT);
+
+    /*
+     * The migrations and the bulk inserts use them. They must never be in the schema, in a trigger or an index, the
+     * other programs opening the database don't have them.
+     */
+    sqlite3_create_function_v2(db, "digest_merge", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, sqlDigestMerge, NULL,
+            NULL, NULL);
+    sqlite3_create_function_v2(db, "digest", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, NULL, sqlDigestStep,
+            sqlDigestFinal, NULL);
+
+    char *sql = "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL; PRAGMA temp_store=MEMORY;"
+        "PRAGMA mmap_size=" DB_STR(DB_MMAP_SIZE) "; PRAGMA cache_size=-" DB_STR(DB_CACHE_KIB) ";"
+        "CREATE TABLE IF NOT EXISTS Records(Id INTEGER PRIMARY KEY, Fingers TEXT, Length INT, Mistakes INT, Time REAL);"
+        /* One row per key (Pair < 256) and per bigram, so the table never holds more than 65536 rows. */
+        "CREATE TABLE IF NOT EXISTS KeyStats(Pair INTEGER PRIMARY KEY, Count INT, Errors INT, Sum INT);";
+
+    rc = sqlite3_exec(db, sql, 0, 0, 0);
+    traceMark("tables checked");
+
+    if (rc == SQLITE_OK)
+    {
+        rc = migrate();
+        traceMark("schema migrated");
+    }
+    if (rc == SQLITE_OK)
+    {
+        rc = sqlite3_exec(db, retention_sql, 0, 0, 0);
+        traceMark("old results pruned");
+    }
+
+    if (rc != SQLITE_OK)
+    {
+        asprintf(message, "SQL error: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        db = NULL;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+static int migrate(void)
+{
+    int n = sizeof(migrations) / sizeof(migrations[0]);
+    sqlite3_stmt *res;
+
+    for (;;)
+    {
+        /* The version is read inside the write transaction, so another instance can't apply a migration twice. */
+        int rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", 0, 0, 0);
+
+        if (rc == SQLITE_OK)
+            rc = sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &res, 0);
+        if (rc != SQLITE_OK)
+            break;
+
+        int version = sqlite3_step(res) == SQLITE_ROW ? sqlite3_column_int(res, 0) : n;
+        sqlite3_finalize(res);
+
+        if (version >= n)
+            return sqlite3_exec(db, "COMMIT;", 0, 0, 0);
+
+        char *sql = 0;
+        asprintf(&sql, "%s PRAGMA user_version = %d;", migrations[version], version + 1);
+        rc = sqlite3_exec(db, sql, 0, 0, 0);
+        free(sql);
+
+        if (rc == SQLITE_OK)
+            rc = sqlite3_exec(db, "COMMIT;", 0, 0, 0);
+        if (rc != SQLITE_OK)
+            break;
+    }
+
+    int rc = sqlite3_errcode(db);
+    sqlite3_exec(db, "ROLLBACK;", 0, 0, 0);
+
+    return rc;
+}
+
+static void sqlDigestResult(sqlite3_context *ctx, const tDigest *d)
+{
+    size_t size = digestSize(d);
+    void *blob = sqlite3_malloc64(size);
+
+    if (blob == NULL)
+    {
+        sqlite3_result_error_nomem(ctx);
+        return;
+    }
+
+    digestWrite(d, blob);
+    sqlite3_result_blob64(ctx, blob, size, sqlite3_free);
+}
+
+static void sqlDigestMerge(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+    tDigest d, from;
+
+    if (sqlite3_value_type(argv[0]) != SQLITE_BLOB ||
+            digestRead(&d, sqlite3_value_blob(argv[0]), sqlite3_value_bytes(argv[0])))
+        digestInit(&d);
+
+    if (sqlite3_value_type(argv[1]) == SQLITE_BLOB &&
+            digestRead(&from, sqlite3_value_blob(argv[1]), sqlite3_value_bytes(argv[1])) == 0)
+        digestMerge(&d, &from);
+
+    digestCompress(&d);
+    sqlDigestResult(ctx, &d);
+}
+
+static void sqlDigestStep(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+    /* The context starts zeroed, which is an empty digest. */
+    tDigest *d = (tDigest *)sqlite3_aggregate_context(ctx, sizeof(tDigest));
+
+    if (d == NULL)
+        sqlite3_result_error_nomem(ctx);
+    else if (sqlite3_value_type(argv[0]) != SQLITE_NULL)
+        digestAdd(d, sqlite3_value_double(argv[0]), 1);
+}
+
+static void sqlDigestFinal(sqlite3_context *ctx)
+{
+    tDigest *d = (tDigest *)sqlite3_aggregate_context(ctx, 0);
+
+    if (d && d->total)
+    {
+        digestCompress(d);
+        sqlDigestResult(ctx, d);
+    }
+    else
+        sqlite3_result_null(ctx);
+}
+
+static void deinitSQLite(void)
+{
+    if (opening)
+        pthread_join(opener, NULL);
+
+    sqlite3_close(db);
+    db = NULL;
+    free(db_file);
+}
+
+sqlite3 *get_db(void)
+{
+    waitDb();
+
+    return db;
+}
+
+static void tableAppend(tTable *t, const char *s, size_t len)
+{
+    if (t->size + len > t->cap)
+    {
+        t->cap = t->cap * 2 > t->size + len ? t->cap * 2 : t->size + len + 256;
+        t->cells = (char *)realloc(t->cells, t->cap);
+
+        if (t->cells == NULL)
+            pexit("tableAppend");
+    }
+
+    memcpy(t->cells + t->size, s, len);
+    t->size += len;
+}
+
+static void tableRow(tTable *t, int argc, char **argv, char **names)
+{
+    for (int i = 0; i < argc; i++)
+    {
+        const char *value = argv[i] ? argv[i] : "NULL";
+        size_t nameLen = strlen(names[i]), valueLen = strlen(value);
+
+        tableAppend(t, names[i], nameLen + 1);
+        tableAppend(t, value, valueLen + 1);
+
+        if ((int)nameLen > t->nameWidth)
+            t->nameWidth = nameLen;
+        /* " = ", the value and its line ending. */
+        t->textSize += valueLen + 4;
+        t->cellCount++;
+    }
+
+    tableAppend(t, "\n", 1);
+    t->textSize++;
+}
+
+static void tableDump(tTable *t)
+{
+    if (t->size == 0)
+        return;
+
+    char *text = (char *)malloc(t->textSize + (size_t)t->cellCount * t->nameWidth + 1);
+    char *out = text;
+
+    if (text == NULL)
+        pexit("tableDump");
+
+    for (const char *p = t->cells; p < t->cells + t->size;)
+    {
+        if (*p == '\n')
+        {
+            *out++ = *p++;
+            continue;
+        }
+
+        size_t nameLen = strlen(p);
+        const char *value = p + nameLen + 1;
+        size_t valueLen = strlen(value);
+
+        memcpy(out, p, nameLen);
+        memset(out + nameLen, ' ', t->nameWidth - nameLen);
+        out += t->nameWidth;
+        memcpy(out, " = ", 3);
+        memcpy(out + 3, value, valueLen);
+        out[3 + valueLen] = '\n';
+        out += valueLen + 4;
+
+        p = value + valueLen + 1;
+    }
+    *out = '\0';
+
+    dumpRows(text, 0, sh_Attrs->numrows);
+    free(text);
+    free(t->cells);
+    memset(t, 0, sizeof(tTable));
+}
+
+static int tableQuery(tTable *t, sqlite3_stmt *res)
+{
+    int n = sqlite3_column_count(res);
+    char *argv[n > 0 ? n : 1], *names[n > 0 ? n : 1];
+    int rc;
+
+    for (int i = 0; i < n; i++)
+        names[i] = (char *)sqlite3_column_name(res, i);
+
+    while ((rc = sqlite3_step(res)) == SQLITE_ROW)
+    {
+        for (int i = 0; i < n; i++)
+            argv[i] = (char *)sqlite3_column_text(res, i);
+
+        tableRow(t, n, argv, names);
+    }
+
+    sqlite3_finalize(res);
+
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+int callback(void *table, int argc, char **argv, char **azColName)
+{
+    tableRow((tTable *)table, argc, argv, azColName);
+
+    return 0;
+}
+
+static int sketchAdd(const char *Fingers, int Length, double time)
+{
+    sqlite3_stmt *res;
+    tDigest d[2];
+    double x[2] = { time, Length * 60.0 / time };
+
+    if (time <= 0)
+        return SQLITE_OK;
+
+    int rc = sqlite3_prepare_v2(db, "SELECT Times, Cpm FROM Sketches WHERE Fingers = ? AND Length = ?;", -1, &res, 0);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    sqlite3_bind_text(res, 1, Fingers, -1, SQLITE_STATIC);
+    sqlite3_bind_int(res, 2, Length);
+
+    int row = sqlite3_step(res) == SQLITE_ROW;
+
+    /* A missing or damaged digest starts over. */
+    for (int i = 0; i < 2; i++)
+    {
+        if (!row || sqlite3_column_type(res, i) != SQLITE_BLOB ||
+                digestRead(&d[i], sqlite3_column_blob(res, i), sqlite3_column_bytes(res, i)))
+            digestInit(&d[i]);
+
+        digestAdd(&d[i], x[i], 1);
+
+        /* The blob is rewritten on every result, past half the buffer it's cheaper to keep it merged. */
+        if (d[i].n >= DIGEST_CAP / 2)
+            digestCompress(&d[i]);
+    }
+
+    sqlite3_finalize(res);
+
+    rc = sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO Sketches VALUES(?, ?, ?, ?);", -1, &res, 0);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    sqlite3_bind_text(res, 1, Fingers, -1, SQLITE_STATIC);
+    sqlite3_bind_int(res, 2, Length);
+
+    for (int i = 0; i < 2; i++)
+    {
+        size_t size = digestSize(&d[i]);
+        void *blob = malloc(size);
+
+        if (blob == NULL)
+        {
+            sqlite3_finalize(res);
+            return SQLITE_NOMEM;
+        }
+
+        digestWrite(&d[i], blob);
+        sqlite3_bind_blob64(res, 3 + i, blob, size, free);
+    }
+
+    rc = sqlite3_step(res) == SQLITE_DONE ? SQLITE_OK : sqlite3_errcode(db);
+    sqlite3_finalize(res);
+
+    return rc;
+}
+
+int insert(char* Fingers, int Length, int Mistakes, float Time)
+{
+    sqlite3_stmt *res;
+
+    if (waitDb())
+        return 1;
+
+    /* The time is saved with 6 decimals, the cache gets the same value. */
+    char time_text[64];
+    snprintf(time_text, sizeof(time_text), "%f", Time);
+    double time_saved = strtod(time_text, NULL);
+
+    /* The result is saved as soon as the test ends, so it started Time seconds ago. */
+    long long started = (long long)time(NULL) - (long long)(Time + 0.5);
+
+    /* The result and its sketches are saved together. */
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", 0, 0, 0) != SQLITE_OK)
+    {
+        dbError("SQL error");
+        return 1;
+    }
+
+    /* The name comes from the user, a drill can be called ' for example, so it's bound and never put in the SQL. */
+    int rc = sqlite3_prepare_v2(db, "INSERT INTO Records(Fingers, Length, Mistakes, Time, StartedAt) "
+            "VALUES(?, ?, ?, ?, ?);", -1, &res, 0);
+
+    if (rc == SQLITE_OK)
+    {
+        sqlite3_bind_text(res, 1, Fingers, -1, SQLITE_STATIC);
+        sqlite3_bind_int(res, 2, Length);
+        sqlite3_bind_int(res, 3, Mistakes);
+        sqlite3_bind_double(res, 4, time_saved);
+        sqlite3_bind_int64(res, 5, started);
+
+        rc = sqlite3_step(res) == SQLITE_DONE ? SQLITE_OK : sqlite3_errcode(db);
+        sqlite3_finalize(res);
+    }
+
+    sqlite3_int64 id = sqlite3_last_insert_rowid(db);
+
+    if (rc == SQLITE_OK)
+        rc = sketchAdd(Fingers, Length, time_saved);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_exec(db, "COMMIT;", 0, 0, 0);
+
+    if (rc != SQLITE_OK)
+    {
+        dbError("SQL error");
+        sqlite3_exec(db, "ROLLBACK;", 0, 0, 0);
+        return 1;
+    }
+
+    last_id = id;
+    cacheAdd(id, Fingers, Length, Mistakes, time_saved);
+
+    return 0;
+}
+
+int begin_bulk_insert(void)
+{
+    sqlite3_stmt *res;
+
+    if (waitDb())
+        return 1;
+
+    /* The drop is part of the transaction, the other instances keep seeing the trigger. */
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE; DROP TRIGGER IF EXISTS RecordsRollup;", 0, 0, 0) != SQLITE_OK ||
+            sqlite3_prepare_v2(db, "SELECT IFNULL(MAX(Id), 0) FROM Records;", -1, &res, 0) != SQLITE_OK)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK;", 0, 0, 0);
+        return 1;
+    }
+
+    bulk_after = sqlite3_step(res) == SQLITE_ROW ? sqlite3_column_int64(res, 0) : 0;
+    sqlite3_finalize(res);
+
+    return 0;
+}
+
+int end_bulk_insert(int commit)
+{
+    sqlite3_stmt *res;
+    const char *batch[] = { rollup_sql, sketch_sql };
+    int rc = commit ? SQLITE_OK : SQLITE_ABORT;
+
+    if (waitDb())
+        return 1;
+
+    /* Rows get Ids after the largest one, so the batch is every row after bulk_after. */
+    for (int i = 0; i < 2; i++)
+    {
+        const char *sql = batch[i];
+
+        while (rc == SQLITE_OK && sql[0] != '\0')
+        {
+            rc = sqlite3_prepare_v2(db, sql, -1, &res, &sql);
+            if (rc != SQLITE_OK)
+                break;
+
+            sqlite3_bind_int64(res, 1, bulk_after);
+            rc = sqlite3_step(res) == SQLITE_DONE ? SQLITE_OK : sqlite3_errcode(db);
+            sqlite3_finalize(res);
+        }
+    }
+
+    if (rc == SQLITE_OK)
+        rc = sqlite3_exec(db, ROLLUP_TRIGGER "COMMIT;", 0, 0, 0);
+
+    if (rc != SQLITE_OK && commit)
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+
+    /* Rolling back brings the trigger back too. */
+    if (rc != SQLITE_OK)
+        sqlite3_exec(db, "ROLLBACK;", 0, 0, 0);
+
+    return commit && rc != SQLITE_OK;
+}
+
+void set_finger_tests(const tFingerDrills *d)
+{
+    finger_tests = d;
+}
+
+static int isFingerTest(const char *Fingers)
+{
+    if (finger_tests)
+    {
+        for (int i = 0; i < finger_tests->n; i++)
+            if (strcmp(Fingers, finger_tests->drill[i].name) == 0)
+                return 1;
+
+        return 0;
+    }
+
+    return strcmp(Fingers,"op") == 0 ||
+        strcmp(Fingers,"l;") == 0 ||
+        strcmp(Fingers,"./") == 0 ||
+        strcmp(Fingers,"qw") == 0 ||
+        strcmp(Fingers,"as") == 0 ||
+        strcmp(Fingers,"zx") == 0;
+}
+
+static int groupKey(const char *name, int length)
+{
+    return isFingerTest(name) ? length : 0;
+}
+
+static char *roundText(double x, char *buf)
+{
+    /* Like ROUND(x, 2) printed by sqlite: 15 significant digits and always a decimal point. */
+    snprintf(buf, 32, "%.2f", x);
+    snprintf(buf, 32, "%.15g", strtod(buf, NULL));
+    if (strpbrk(buf, ".en") == NULL)
+        strcat(buf, ".0");
+
+    return buf;
+}
+
+static void cacheAverage(char *Fingers, int Length)
+{
+    const tTestCache *t = cacheTest(Fingers);
+    char *names[] = {"Fingers", "Length", "Average Time", "Average mistakes per test"};
+    char *values[4] = {NULL, NULL, NULL, NULL};
+    tTable table = TABLE_INIT;
+    char length[16], time[32], mistakes[32];
+    long count = 0;
+    double sumTime = 0;
+    long long sumMistakes = 0;
+
+    for (int i = 0; t && i < t->nlens; i++)
+        if (!isFingerTest(Fingers) || t->lens[i].length == Length)
+        {
+            count += t->lens[i].count;
+            sumTime += t->lens[i].sumTime;
+            sumMistakes += t->lens[i].sumMistakes;
+            snprintf(length, sizeof(length), "%d", t->lens[i].length);
+        }
+
+    /* Without results every column is NULL, like the aggregate of no rows. */
+    if (count)
+    {
+        /* Length isn't aggregated, sqlite shows the one of some row of the test. This shows the slowest one. */
+        const tResultCols *g = cacheGroup(t, groupKey(Fingers, Length));
+        if (g && g->n)
+            snprintf(length, sizeof(length), "%d", g->length[g->n - 1]);
+
+        values[0] = Fingers;
+        values[1] = length;
+        values[2] = roundText(sumTime / count, time);
+        values[3] = roundText((double)sumMistakes / count, mistakes);
+    }
+
+    tableRow(&table, 4, values, names);
+    tableDump(&table);
+}
+
+static void cacheAllAverages(char *Fingers)
+{
+    char a[32], b[32], c[32], d[32], e[32];
+    tTable table = TABLE_INIT;
+
+    if (Fingers)
+    {
+        const tTestCache *t = cacheTest(Fingers);
+        char *names[] = {"Fingers", "Length", "Average Time", "Average mistakes per test", "Clicks per minute",
+            "Mistakes per 100 clicks"};
+
+        for (int i = 0; t && i < t->nlens; i++)
+        {
+            const tLengthStats *l = &t->lens[i];
+            double avgTime = l->sumTime / l->count, avgMistakes = (double)l->sumMistakes / l->count;
+            char *values[6] = {t->name, a, roundText(avgTime, b), roundText(avgMistakes, c),
+                avgTime != 0 ? roundText(l->length / avgTime * 60, d) : NULL,
+                l->length ? roundText(avgMistakes / l->length * 100, e) : NULL};
+
+            snprintf(a, sizeof(a), "%d", l->length);
+            tableRow(&table, 6, values, names);
+        }
+
+        tableDump(&table);
+        return;
+    }
+
+    const tTestCache * const *tests;
+    int ntests = cacheTests(&tests);
+    char *names[] = {"Tests Taken", "Total characters typed", "Fingers", "CPM", "Mistakes per 100 key presses"};
+
+    for (int i = 0; i < ntests; i++)
+    {
+        long count = 0;
+        long long sumLength = 0, sumMistakes = 0;
+        double sumTime = 0;
+
+        for (int j = 0; j < tests[i]->nlens; j++)
+        {
+            const tLengthStats *l = &tests[i]->lens[j];
+
+            count += l->count;
+            sumLength += (long long)l->length * l->count;
+            sumMistakes += l->sumMistakes;
+            sumTime += l->sumTime;
+        }
+
+        char *values[5] = {a, b, tests[i]->name, sumTime != 0 ? roundText(sumLength / sumTime * 60, c) : NULL,
+            sumLength ? roundText((double)sumMistakes / sumLength * 100, d) : NULL};
+
+        snprintf(a, sizeof(a), "%ld", count);
+        snprintf(b, sizeof(b), "%lld", sumLength);
+        tableRow(&table, 5, values, names);
+    }
+
+    tableDump(&table);
+}
+
+static char *pageLine(int pos, const char *name, int length, int mistakes, double t)
+{
+    char *line = 0;
+
+    asprintf(&line, "%7d  %-16.16s %6d %8d %9.2f %9.2f\n", pos, name, length, mistakes, t, t > 0 ? length / t * 60 : 0);
+
+    return line;
+}
+
+static int sqlPage(tPager *p, sqlite3_stmt *res, int dir, int pos, int size, char **lines, tPageKey *key)
+{
+    int n = 0;
+    tPageKey *from = dir == PAGE_NEXT ? &p->last : &p->first;
+
+    sqlite3_bind_text(res, 1, p->fingers, -1, SQLITE_STATIC);
+    sqlite3_bind_int(res, 2, p->length);
+    sqlite3_bind_double(res, 3, dir == PAGE_FIRST ? -1e308 : from->time);
+    sqlite3_bind_int(res, 4, dir == PAGE_FIRST ? 0 : from->length);
+    sqlite3_bind_int64(res, 5, dir == PAGE_FIRST ? 0 : from->id);
+    sqlite3_bind_int(res, 6, size);
+
+    while (sqlite3_step(res) == SQLITE_ROW)
+    {
+        /* A previous page comes backwards, it's stored from its end. */
+        int i = dir == PAGE_PREV ? size - 1 - n : n;
+        double t = sqlite3_column_double(res, 3);
+        int length = sqlite3_column_int(res, 1);
+
+        key[i].time = t;
+        key[i].length = length;
+        key[i].id = sqlite3_column_int64(res, 4);
+        lines[i] = pageLine(dir == PAGE_PREV ? pos - n : pos + n, (const char *)sqlite3_column_text(res, 0), length,
+                sqlite3_column_int(res, 2), t);
+        n++;
+    }
+
+    sqlite3_finalize(res);
+
+    return n;
+}
+
+static int cachePage(tPager *p, int dir, int pos, int size, char **lines, tPageKey *key)
+{
+    const tResultCols *g = cacheGroup(cacheTest(p->fingers), p->length);
+    int n = 0;
+
+    /* The position in the list is the index in the sorted columns, so a page is read straight from it. */
+    for (int r = pos - 1; g && n < size && r >= 0 && r < g->n; r += dir == PAGE_PREV ? -1 : 1)
+    {
+        int i = dir == PAGE_PREV ? size - 1 - n : n;
+
+        key[i].time = g->time[r];
+        key[i].length = g->length[r];
+        key[i].id = g->id[r];
+        lines[i] = pageLine(r + 1, p->fingers, g->length[r], g->mistakes[r], g->time[r]);
+        n++;
+    }
+
+    return n;
+}
+
+void open_pager(tPager *p, char *Fingers, int Length, int size, int limit)
+{
+    snprintf(p->fingers, sizeof(p->fingers), "%s", Fingers);
+    /* Length only tells tests apart for the default 2finger tests. */
+    p->length = isFingerTest(Fingers) ? Length : 0;
+    p->size = size < 1 ? 1 : size > PAGE_MAX ? PAGE_MAX : size;
+    p->limit = limit;
+    p->offset = 0;
+    p->count = 0;
+}
+
+int page_results(tPager *p, int dir, int line)
+{
+    sqlite3_stmt *res;
+    char *lines[PAGE_MAX];
+    tPageKey key[PAGE_MAX];
+    int n = 0;
+    /* Position of the first row read, a previous page is read from its last row. */
+    int pos = dir == PAGE_FIRST ? 1 : dir == PAGE_NEXT ? p->offset + p->count + 1 : p->offset;
+    int size = p->size;
+
+    if (waitDb())
+        return 1;
+
+    /*
+     * The page starts after the last row shown, or ends before the first one, so the index on (Fingers, Time,
+     * Length) goes straight to it whatever the number of rows before. Id breaks the ties, the index holds it too.
+     */
+    const char *sql[2] = {
+        "SELECT Fingers, Length, Mistakes, Time, Id FROM Records WHERE Fingers = ?1 AND (?2 = 0 OR Length = ?2) \
+            AND Time IS NOT NULL AND (Time, Length, Id) > (?3, ?4, ?5) ORDER BY Time, Length, Id LIMIT ?6;",
+        "SELECT Fingers, Length, Mistakes, Time, Id FROM Records WHERE Fingers = ?1 AND (?2 = 0 OR Length = ?2) \
+            AND Time IS NOT NULL AND (Time, Length, Id) < (?3, ?4, ?5) ORDER BY Time DESC, Length DESC, Id DESC \
+            LIMIT ?6;"};
+
+    if (dir == PAGE_PREV && p->offset == 0)
+        return 0;
+
+    /* The last page of a top-N list is cut at N. */
+    if (p->limit && dir != PAGE_PREV && size > p->limit - pos + 1)
+        size = p->limit - pos + 1;
+    if (size <= 0)
+        return 0;
 
-/*
- * This funtion needs to be called before sqlite operations.
- * It initializes the db and sh_Attrs pointers.
- */
-int init_sqlite_db(void)
+    if (cacheReady())
+        n = cachePage(p, dir, pos, size, lines, key);
+    else if (sqlite3_prepare_v2(db, sql[dir == PAGE_PREV], -1, &res, 0) != SQLITE_OK)
+    {
+        dbError("SQL error");
+        return 1;
+    }
+    else
+        n = sqlPage(p, res, dir, pos, size, lines, key);
+
+    /* Nothing before or after the page shown, it stays. */
+    if (n == 0 && dir != PAGE_FIRST)
+        return 0;
+
+    int first = dir == PAGE_PREV ? size - n : 0;
+
+    p->offset = dir == PAGE_PREV ? pos - n : pos - 1;
+    p->count = n;
+
+    /* The page is inserted at once, with its header. */
+    static const char *header = "      #  Test               Length Mistakes      Time       CPM\n";
+    size_t total = strlen(header);
+
+    for (int i = first; i < first + n; i++)
+        total += strlen(lines[i]);
+
+    char *page = (char *)malloc(total + 1);
+    char *out = page;
+
+    if (page == NULL)
+        pexit("page_results");
+
+    out = stpcpy(out, header);
+    for (int i = first; i < first + n; i++)
+    {
+        out = stpcpy(out, lines[i]);
+        free(lines[i]);
+    }
+
+    delRows(line);
+    dumpRows(page, 0, line);
+    free(page);
+
+    if (n)
+    {
+        p->first = key[first];
+        p->last = key[first + n - 1];
+    }
+    else
+        dumpRows("No results for this test\n", 0, sh_Attrs->numrows);
+
+    dumpRows("Page Up and Page Down scroll the results, Enter returns\n", 0, sh_Attrs->numrows);
+
+    return 0;
+}
+
+int get_last_rank(int *rank, int *slower, int *total)
 {
-    char *err_msg = 0;
     sqlite3_stmt *res;
-    sh_Attrs = getTermAttributes();
 
-    int rc = sqlite3_open("test.db", &db);
+    if (waitDb())
+        return 1;
 
-    if (rc != SQLITE_OK) {
+    if (cacheReady())
+    {
+        const tTestCache *t;
+        const tResultCols *g;
+        double time;
+        int better;
 
-        asprintf(&err_msg, "Cannot open database: %s\n",
-                sqlite3_errmsg(db));
-        dumpRows(err_msg, 0, sh_Attrs->numrows);
-        free(err_msg);
-        sqlite3_close(db);
+        cacheLast(&t, &g, &time);
+        if (g == NULL)
+            return 1;
+
+        cacheRank(g, time, &better, slower);
+        *rank = better + 1;
+        *total = g->n;
+
+        return 0;
+    }
 
+    if (sqlite3_prepare_v2(db, "SELECT Fingers, Length, Time FROM Records WHERE Id = ?;", -1, &res, 0) != SQLITE_OK)
+    {
+        dbError("SQL error");
         return 1;
     }
 
-    char *sql = "SELECT name FROM sqlite_master WHERE type='table' AND name='Records';";
-    rc = sqlite3_prepare_v2(db, sql, -1, &res, 0);
+    sqlite3_bind_int64(res, 1, last_id);
 
-    if (rc != SQLITE_OK)
+    if (sqlite3_step(res) != SQLITE_ROW || sqlite3_column_type(res, 0) == SQLITE_NULL)
     {
-        asprintf(&err_msg, "Failed to fetch data: %s\n", sqlite3_errmsg(db));
-        dumpRows(err_msg, 0, sh_Attrs->numrows);
-        free(err_msg);
-        sqlite3_close(db);
+        sqlite3_finalize(res);
+        return 1;
+    }
+
+    /* The drills are ranked among the results of the same length, like the averages. */
+    char fingers[64];
+    snprintf(fingers, sizeof(fingers), "%s", (const char *)sqlite3_column_text(res, 0));
+    int length = isFingerTest(fingers) ? sqlite3_column_int(res, 1) : 0;
+    double time = sqlite3_column_double(res, 2);
+    sqlite3_finalize(res);
+
+    /*
+     * Every count is a range of the index on (Fingers, Time, Length) for the values of the last result, the length
+     * is checked on the index rows so the table itself isn't read.
+     */
+    const char *sql = "SELECT \
+            (SELECT COUNT(*) FROM Records WHERE Fingers = ?1 AND (?2 = 0 OR Length = ?2) AND Time < ?3), \
+            (SELECT COUNT(*) FROM Records WHERE Fingers = ?1 AND (?2 = 0 OR Length = ?2) AND Time > ?3), \
+            (SELECT COUNT(*) FROM Records WHERE Fingers = ?1 AND (?2 = 0 OR Length = ?2) AND Time IS NOT NULL);";
+
+    if (sqlite3_prepare_v2(db, sql, -1, &res, 0) != SQLITE_OK)
+    {
+        dbError("SQL error");
+        return 1;
+    }
 
+    sqlite3_bind_text(res, 1, fingers, -1, SQLITE_STATIC);
+    sqlite3_bind_int(res, 2, length);
+    sqlite3_bind_double(res, 3, time);
+
+    if (sqlite3_step(res) != SQLITE_ROW)
+    {
+        sqlite3_finalize(res);
         return 1;
     }
 
-    int step = sqlite3_step(res);
+    *rank = sqlite3_column_int(res, 0) + 1;
+    *slower = sqlite3_column_int(res, 1);
+    *total = sqlite3_column_int(res, 2);
     sqlite3_finalize(res);
-    if (step != SQLITE_ROW)
+
+    return 0;
+}
+
+int get_percentiles(char *Fingers, int Length)
+{
+    sqlite3_stmt *res;
+    static const int percent[] = {50, 90, 99};
+    /* Every drill of the auto test when no test is given. */
+    int drills = Fingers[0] == '\0';
+    tDigest times, cpm, one;
+
+    if (waitDb())
+        return 1;
+
+    if (!drills && isFingerTest(Fingers) == 0)
+        Length = 0;
+
+    /* The sketches of every length and drill asked for are merged, whatever the number of results they hold. */
+    const char *sql = drills ? "SELECT Fingers, Times, Cpm FROM Sketches WHERE Length = ?2;" :
+        "SELECT Fingers, Times, Cpm FROM Sketches WHERE Fingers = ?1 AND (?2 = 0 OR Length = ?2);";
+
+    if (sqlite3_prepare_v2(db, sql, -1, &res, 0) != SQLITE_OK)
     {
-        sql =  "CREATE TABLE Records(Id INTEGER PRIMARY KEY, Fingers TEXT,\
-            Length INT, Mistakes INT, Time REAL);";
-        rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
+        dbError("SQL error");
+        return 1;
+    }
 
-        if (rc != SQLITE_OK )
-        {
+    sqlite3_bind_text(res, 1, Fingers, -1, SQLITE_STATIC);
+    sqlite3_bind_int(res, 2, Length);
+    digestInit(&times);
+    digestInit(&cpm);
+
+    while (sqlite3_step(res) == SQLITE_ROW)
+    {
+        if (drills && !isFingerTest((const char *)sqlite3_column_text(res, 0)))
+            continue;
 
-            char *message = 0;
-            asprintf(&message, "SQL error: %s\n", err_msg);
-            dumpRows(message, 0, sh_Attrs->numrows);
-            free(message);
+        if (digestRead(&one, sqlite3_column_blob(res, 1), sqlite3_column_bytes(res, 1)) == 0)
+            digestMerge(&times, &one);
+        if (digestRead(&one, sqlite3_column_blob(res, 2), sqlite3_column_bytes(res, 2)) == 0)
+            digestMerge(&cpm, &one);
+    }
 
-            sqlite3_free(err_msg);
-            sqlite3_close(db);
+    sqlite3_finalize(res);
 
-            return 1;
-        }
-            sqlite3_free(err_msg);
+    if (times.total == 0)
+    {
+        dumpRows("No results for this test\n", 0, sh_Attrs->numrows);
+        return 0;
     }
-    atexit(deinitSQLite);
+
+    char text[512];
+    int len = snprintf(text, sizeof(text), "%.0f results of %s\n", times.total, drills ? "the drills" : Fingers);
+    int n = sizeof(percent) / sizeof(percent[0]);
+
+    for (int i = 0; i < n && len < (int)sizeof(text); i++)
+        len += snprintf(text + len, sizeof(text) - len, "p%d = %.2f seconds\n", percent[i],
+                digestQuantile(&times, percent[i] / 100.0));
+
+    /* The speed reached by that many of the results, the fastest ones. */
+    for (int i = 0; i < n && len < (int)sizeof(text); i++)
+        len += snprintf(text + len, sizeof(text) - len, "%d%% of them reach %.2f CPM\n", percent[i],
+                digestQuantile(&cpm, 1 - percent[i] / 100.0));
+
+    dumpRows(text, 0, sh_Attrs->numrows);
+
     return 0;
 }
 
-static void deinitSQLite(void)
+int set_retention(int days)
 {
-    sqlite3_close(db);
+    sqlite3_stmt *res;
+
+    if (waitDb())
+        return -1;
+
+    if (sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO Settings(Name, Value) VALUES('RetentionDays', ?);", -1, &res,
+                0) != SQLITE_OK)
+        return -1;
+
+    sqlite3_bind_int(res, 1, days);
+    int rc = sqlite3_step(res);
+    sqlite3_finalize(res);
+
+    if (rc != SQLITE_DONE || sqlite3_exec(db, retention_sql, 0, 0, 0) != SQLITE_OK)
+        return -1;
+
+    return sqlite3_changes(db);
 }
-int callback(void *NotUsed, int argc, char **argv, char **azColName)
+
+int get_trend(char *Fingers, int weekly, int width)
 {
-    NotUsed = 0;
-    for (int i = 0; i < argc; i++)
+    sqlite3_stmt *res;
+    static const char *level[] = {"▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"};
+    double cpm[TREND_MAX];
+    char start[TREND_MAX][11];
+    int step = weekly ? 7 : 1;
+
+    if (waitDb())
+        return 1;
+
+    if (width > TREND_MAX)
+        width = TREND_MAX;
+    if (width < 1)
+        width = 1;
+
+    /*
+     * Only the width last periods of the test are read, a range of the primary key of the totals, so the cost
+     * depends on the periods shown and not on the tests taken.
+     */
+    const char *sql = weekly ?
+        "SELECT julianday(Start), Start, Length, Time FROM WeeklyStats WHERE Fingers = ?1 AND Start > \
+            date((SELECT MAX(Start) FROM WeeklyStats WHERE Fingers = ?1), ?2) ORDER BY Start;" :
+        "SELECT julianday(Start), Start, Length, Time FROM DailyStats WHERE Fingers = ?1 AND Start > \
+            date((SELECT MAX(Start) FROM DailyStats WHERE Fingers = ?1), ?2) ORDER BY Start;";
+
+    if (sqlite3_prepare_v2(db, sql, -1, &res, 0) != SQLITE_OK)
     {
-        char *message = 0;
-        asprintf(&message, "%s = %s\n", azColName[i], argv[i] ?  argv[i] : "NULL");
-        dumpRows(message, 0, sh_Attrs->numrows);
-        free(message);
+        dbError("SQL error");
+        return 1;
     }
 
-    dumpRows("\n", 0, sh_Attrs->numrows);
+    char span[32];
+    snprintf(span, sizeof(span), "-%d days", width * step);
+    sqlite3_bind_text(res, 1, Fingers, -1, SQLITE_STATIC);
+    sqlite3_bind_text(res, 2, span, -1, SQLITE_TRANSIENT);
 
-    return 0;
-}
+    /* The periods are put in their slots from the first one read, the ones without tests stay at -1. */
+    double first = 0;
+    int slots = 0;
+    while (sqlite3_step(res) == SQLITE_ROW)
+    {
+        int slot = slots ? (int)((sqlite3_column_double(res, 0) - first) / step + 0.5) : 0;
+        double t = sqlite3_column_double(res, 3);
 
-int insert(char* Fingers, int Length, int Mistakes, float Time)
-{
-    char *sql;
-    int rc;
-    char *err_msg = 0;
+        if (slots == 0)
+            first = sqlite3_column_double(res, 0);
+        if (slot >= width)
+            break;
 
-    asprintf(&sql, "INSERT INTO Records(Fingers, Length, Mistakes, Time) \
-            VALUES('%s', '%d', '%d', '%f');", Fingers, Length, Mistakes, Time);
-    rc = sqlite3_exec(db, sql, callback, 0, &err_msg);
-    free(sql);
+        for (; slots <= slot; slots++)
+            cpm[slots] = -1;
 
-    if (rc != SQLITE_OK )
+        cpm[slot] = t > 0 ? sqlite3_column_double(res, 2) / t * 60 : 0;
+        snprintf(start[slot], sizeof(start[slot]), "%s", (const char *)sqlite3_column_text(res, 1));
+    }
+
+    sqlite3_finalize(res);
+
+    if (slots == 0)
     {
-        char *message = 0;
-        asprintf(&message, "SQL error: %s\n", err_msg);
-        dumpRows(message, 0, sh_Attrs->numrows);
-        free(message);
+        dumpRows("No dated results for this test\n", 0, sh_Attrs->numrows);
+        return 0;
+    }
 
-        sqlite3_free(err_msg);
-        sqlite3_close(db);
+    int lo = 0, hi = 0;
+    for (int i = 0; i < slots; i++)
+        if (cpm[i] >= 0)
+        {
+            if (cpm[i] < cpm[lo])
+                lo = i;
+            if (cpm[i] > cpm[hi])
+                hi = i;
+        }
 
-        return 1;
+    char *spark = (char *)malloc(slots * 3 + 2);
+    if (spark == NULL)
+        pexit("get_trend");
+
+    char *w = spark;
+    for (int i = 0; i < slots; i++)
+    {
+        if (cpm[i] < 0)
+        {
+            *w++ = ' ';
+            continue;
+        }
+
+        int l = cpm[hi] > cpm[lo] ? (int)((cpm[i] - cpm[lo]) / (cpm[hi] - cpm[lo]) * 7 + 0.5) : 7;
+        memcpy(w, level[l], 3);
+        w += 3;
     }
+    *w++ = '\n';
+    *w = '\0';
+
+    char *message = 0;
+    asprintf(&message, "CPM of %s per %s from %s to %s\n", Fingers, weekly ? "week" : "day", start[0],
+            start[slots - 1]);
+    dumpRows(message, 0, sh_Attrs->numrows);
+    free(message);
+
+    dumpRows(spark, 0, sh_Attrs->numrows);
+    free(spark);
+
+    asprintf(&message, "Slowest %.2f (%s), fastest %.2f (%s), last %.2f\n", cpm[lo], start[lo], cpm[hi], start[hi],
+            cpm[slots - 1]);
+    dumpRows(message, 0, sh_Attrs->numrows);
+    free(message);
 
     return 0;
 }
 
-int get_nmin(char *Fingers, int Length, char no_of_results)
+int get_average(char *Fingers, int Length)
 {
-    int rc;
-    char *err_msg = 0;
-    char *sql;
+    sqlite3_stmt *res;
+    tTable table = TABLE_INIT;
+
+    if (waitDb())
+        return 1;
+
+    if (cacheReady())
+    {
+        cacheAverage(Fingers, Length);
+        return 0;
+    }
 
     /*
      * Check if the test belongs to the default 2finger tests, if it doesn't diregard Length.
      */
-    if (strcmp(Fingers,"op") == 0 ||
-            strcmp(Fingers,"l;") == 0 ||
-            strcmp(Fingers,"./") == 0 ||
-            strcmp(Fingers,"qw") == 0 ||
-            strcmp(Fingers,"as") == 0 ||
-            strcmp(Fingers,"zx") == 0 )
+    if (isFingerTest(Fingers) == 0)
+        Length = 0;
+
+    const char *sql = "SELECT Fingers, Length, ROUND(AVG(Time), 2) AS [Average Time], \
+            ROUND(AVG(Mistakes), 2) AS [Average mistakes per test] FROM Records WHERE Fingers = ?1 \
+            AND (?2 = 0 OR Length = ?2);";
+
+    if (sqlite3_prepare_v2(db, sql, -1, &res, 0) != SQLITE_OK)
     {
-        asprintf(&sql, "SELECT Fingers, Length, Mistakes, ROUND(Time, 2) as Time, \
-                ROUND(Length / Time * 60, 2)  as CPM FROM Records WHERE Fingers='%s' AND \
-                Length ='%d' order by Time asc limit %c;", Fingers, Length, no_of_results);
+        dbError("SQL error");
+        return 1;
     }
-    else
+
+    sqlite3_bind_text(res, 1, Fingers, -1, SQLITE_STATIC);
+    sqlite3_bind_int(res, 2, Length);
+
+    int rc = tableQuery(&table, res);
+    tableDump(&table);
+
+    if (rc != SQLITE_OK)
     {
-        asprintf(&sql, "SELECT Fingers, Length, Mistakes, ROUND(Time, 2) as Time, \
-                ROUND(Length / Time * 60, 2)  as CPM FROM Records WHERE Fingers='%s'\
-                order by Time asc limit %c;", Fingers, no_of_results);
+        dbError("SQL error");
+        return 1;
     }
 
-    rc = sqlite3_exec(db, sql, callback, 0, &err_msg);
-    free(sql);
+    return 0;
+}
 
-    if (rc != SQLITE_OK )
+int get_all_averages(char *Fingers)
+{
+    sqlite3_stmt *res;
+    tTable table = TABLE_INIT;
+    const char *sql;
+
+    if (waitDb())
+        return 1;
+
+    if (cacheReady())
     {
+        cacheAllAverages(Fingers);
+        return 0;
+    }
+    if (Fingers)
+        sql = "SELECT Fingers, Length, ROUND(AVG(Time), 2) AS [Average Time], ROUND(AVG(Mistakes), 2) AS\
+                [Average mistakes per test],  ROUND(Length / AVG(Time) * 60, 2) as [Clicks per minute], \
+                ROUND(AVG(Mistakes) / Length * 100, 2) as [Mistakes per 100 clicks] FROM Records \
+                WHERE Fingers = ? GROUP BY Length;";
+    else
+        sql = "SELECT COUNT(Id) as [Tests Taken], Sum(Length) as [Total characters typed], Fingers, \
+                ROUND(Sum(Length) / Sum(Time) * 60, 2) AS [CPM], ROUND(cast(Sum(Mistakes) as FLOAT) /\
+                Sum(Length) * 100, 2) AS [Mistakes per 100 key presses] FROM Records GROUP BY Fingers;";
 
-        char *message = 0;
-        asprintf(&message, "SQL error: %s\n", err_msg);
-        dumpRows(message, 0, sh_Attrs->numrows);
-        free(message);
+    if (sqlite3_prepare_v2(db, sql, -1, &res, 0) != SQLITE_OK)
+    {
+        dbError("SQL error");
+        return 1;
+    }
 
-        sqlite3_free(err_msg);
-        sqlite3_close(db);
+    if (Fingers)
+        sqlite3_bind_text(res, 1, Fingers, -1, SQLITE_STATIC);
+
+    int rc = tableQuery(&table, res);
+    tableDump(&table);
 
+    if (rc != SQLITE_OK)
+    {
+        dbError("SQL error");
         return 1;
     }
 
     return 0;
 }
 
-int get_average(char *Fingers, int Length)
+int save_key_stats(tKeyLog *log)
 {
     int rc;
-    char *err_msg = 0;
-    char *sql = 0;
+    sqlite3_stmt *res;
 
-    /*
-     * Check if the test belongs to the default 2finger tests, if it doesn't diregard Length.
-     */
-    if (strcmp(Fingers,"op") == 0 ||
-            strcmp(Fingers,"l;") == 0 ||
-            strcmp(Fingers,"./") == 0 ||
-            strcmp(Fingers,"qw") == 0 ||
-            strcmp(Fingers,"as") == 0 ||
-            strcmp(Fingers,"zx") == 0 )
+    if (waitDb())
+        return 1;
+
+    keyLogCompact(log);
+
+    char *sql = "INSERT INTO KeyStats(Pair, Count, Errors, Sum) VALUES(?, ?, ?, ?) ON CONFLICT(Pair) DO UPDATE SET \
+            Count = Count + excluded.Count, Errors = Errors + excluded.Errors, Sum = Sum + excluded.Sum;";
+
+    rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", 0, 0, 0);
+
+    if (rc == SQLITE_OK)
+        rc = sqlite3_prepare_v2(db, sql, -1, &res, 0);
+
+    if (rc != SQLITE_OK)
     {
-        asprintf(&sql,"SELECT Fingers, Length, ROUND(AVG(Time), 2) AS [Average Time], \
-                ROUND(AVG(Mistakes), 2) AS [Average mistakes per test] FROM Records WHERE FINGERS='%s' \
-                AND Length='%d';", Fingers, Length);
+        char *message = 0;
+        asprintf(&message, "SQL error: %s\n", sqlite3_errmsg(db));
+        dumpRows(message, 0, sh_Attrs->numrows);
+        free(message);
+
+        sqlite3_exec(db, "ROLLBACK;", 0, 0, 0);
+
+        return 1;
     }
-    else
+
+    for (int i = 0; i < log->n && rc == SQLITE_OK; i++)
     {
-        asprintf(&sql,"SELECT Fingers, Length, ROUND(AVG(Time), 2) AS [Average Time], \
-                ROUND(AVG(Mistakes), 2) AS [Average mistakes per test] FROM Records \
-                WHERE FINGERS='%s';", Fingers);
+        sqlite3_bind_int(res, 1, log->ev[i].pair);
+        sqlite3_bind_int64(res, 2, log->ev[i].count);
+        sqlite3_bind_int64(res, 3, log->ev[i].errors);
+        sqlite3_bind_int64(res, 4, log->ev[i].sum);
+
+        if (sqlite3_step(res) == SQLITE_DONE)
+            rc = sqlite3_reset(res);
+        else
+            rc = SQLITE_ERROR;
     }
 
-    rc = sqlite3_exec(db, sql, callback, 0, &err_msg);
-    free(sql);
+    sqlite3_finalize(res);
 
-    if (rc != SQLITE_OK )
+    if (rc != SQLITE_OK)
     {
         char *message = 0;
-        asprintf(&message, "SQL error: %s\n", err_msg);
+        asprintf(&message, "SQL error: %s\n", sqlite3_errmsg(db));
         dumpRows(message, 0, sh_Attrs->numrows);
         free(message);
 
-        sqlite3_free(err_msg);
-        sqlite3_close(db);
+        sqlite3_exec(db, "ROLLBACK;", 0, 0, 0);
 
         return 1;
     }
 
+    sqlite3_exec(db, "COMMIT;", 0, 0, 0);
+
     return 0;
 }
 
-int get_all_averages(char *Fingers)
+int load_key_stats(tKeyStat **stats, int *n)
+{
+    int rc;
+    int cap = 256;
+    sqlite3_stmt *res;
+
+    *n = 0;
+    *stats = (tKeyStat *)malloc(sizeof(tKeyStat) * cap);
+
+    if (*stats == 0)
+        pexit("load_key_stats");
+
+    if (waitDb())
+        return 1;
+
+    rc = sqlite3_prepare_v2(db, "SELECT Pair, Count, Errors, Sum FROM KeyStats;", -1, &res, 0);
+
+    if (rc != SQLITE_OK)
+    {
+        char *message = 0;
+        asprintf(&message, "SQL error: %s\n", sqlite3_errmsg(db));
+        dumpRows(message, 0, sh_Attrs->numrows);
+        free(message);
+
+        return 1;
+    }
+
+    while (sqlite3_step(res) == SQLITE_ROW)
+    {
+        if (*n == cap)
+        {
+            cap *= 2;
+            tKeyStat *new = (tKeyStat *)realloc(*stats, sizeof(tKeyStat) * cap);
+
+            if (new == 0)
+                pexit("load_key_stats");
+
+            *stats = new;
+        }
+
+        (*stats)[*n].pair = sqlite3_column_int(res, 0);
+        (*stats)[*n].count = sqlite3_column_int64(res, 1);
+        (*stats)[*n].errors = sqlite3_column_int64(res, 2);
+        (*stats)[*n].sum = sqlite3_column_int64(res, 3);
+        (*n)++;
+    }
+
+    sqlite3_finalize(res);
+
+    return 0;
+}
+
+int get_slowest_keys(int no_of_results)
 {
     int rc;
     char *err_msg = 0;
     char *sql = 0;
-    if (Fingers)
-        asprintf(&sql,"SELECT Fingers, Length, ROUND(AVG(Time), 2) AS [Average Time], ROUND(AVG(Mistakes), 2) AS\
-                [Average mistakes per test],  ROUND(Length / AVG(Time) * 60, 2) as [Clicks per minute], \
-                ROUND(AVG(Mistakes) / Length * 100, 2) as [Mistakes per 100 clicks] FROM Records \
-                WHERE FINGERS='%s' GROUP BY Length;", Fingers);
-    else
-        asprintf(&sql,"SELECT COUNT(Id) as [Tests Taken], Sum(Length) as [Total characters typed], Fingers, \
-                ROUND(Sum(Length) / Sum(Time) * 60, 2) AS [CPM], ROUND(cast(Sum(Mistakes) as FLOAT) /\
-                Sum(Length) * 100, 2) AS [Mistakes per 100 key presses] FROM Records GROUP BY Fingers;");
+    tTable table = TABLE_INIT;
 
-    rc = sqlite3_exec(db, sql, callback, 0, &err_msg);
+    if (waitDb())
+        return 1;
+
+    /* The table has at most 65536 rows whatever the number of tests, so sorting it is always fast. */
+    asprintf(&sql, "SELECT " KEY_LABEL(KEY_BYTE("Pair")) " AS Key, Count AS [Times typed], \
+            ROUND(Sum / 1000.0 / Count, 1) AS [Average ms], \
+            ROUND(Errors * 100.0 / (Count + Errors), 2) AS [Mistakes per 100 key presses] \
+            FROM KeyStats WHERE Pair < 256 AND Count > 0 ORDER BY Sum * 1.0 / Count DESC LIMIT %d;\
+            SELECT " KEY_LABEL(KEY_BYTE("Pair >> 8") " || " KEY_BYTE("Pair & 255")) " AS Bigram, \
+            Count AS [Times typed], \
+            ROUND(Sum / 1000.0 / Count, 1) AS [Average ms], \
+            ROUND(Errors * 100.0 / (Count + Errors), 2) AS [Mistakes per 100 key presses] \
+            FROM KeyStats WHERE Pair >= 256 AND Count > 0 ORDER BY Sum * 1.0 / Count DESC LIMIT %d;",
+            no_of_results, no_of_results);
+
+    rc = sqlite3_exec(db, sql, callback, &table, &err_msg);
     free(sql);
+    tableDump(&table);
 
     if (rc != SQLITE_OK )
     {
@@ -236,7 +1643,6 @@ int get_all_averages(char *Fingers)
         free(message);
 
         sqlite3_free(err_msg);
-        sqlite3_close(db);
 
         return 1;
     }
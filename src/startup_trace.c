@@ -0,0 +1,92 @@
+#include <startup_trace.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Type definitios */
+
+/*
+ * A phase that ended, and the thread it ran in.
+ */
+typedef struct tTraceMark
+{
+    const char *phase;
+    pthread_t thread;
+    struct timespec at;
+} tTraceMark;
+
+/* Local functions */
+
+/*
+ * Prints every mark recorded, it's called at exit.
+ */
+static void tracePrint(void);
+
+/*
+ * Milliseconds from a to b.
+ */
+static double elapsedMs(const struct timespec *a, const struct timespec *b);
+
+/* Static variables */
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static int enabled = 0;
+static struct timespec start;
+static tTraceMark marks[TRACE_MAX];
+static int nmarks = 0;
+
+void traceStart(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    enabled = 1;
+    atexit(tracePrint);
+}
+
+void traceMark(const char *phase)
+{
+    struct timespec now;
+
+    if (!enabled)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&mutex);
+    if (nmarks < TRACE_MAX)
+    {
+        marks[nmarks].phase = phase;
+        marks[nmarks].thread = pthread_self();
+        marks[nmarks].at = now;
+        nmarks++;
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+static double elapsedMs(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1e3 + (b->tv_nsec - a->tv_nsec) / 1e6;
+}
+
+static void tracePrint(void)
+{
+    pthread_mutex_lock(&mutex);
+
+    fprintf(stderr, "Startup trace (ms)      at    took  phase\n");
+    for (int i = 0; i < nmarks; i++)
+    {
+        /* A phase starts when the previous one of its thread ended, or with the trace. */
+        const struct timespec *from = &start;
+        for (int j = i - 1; j >= 0; j--)
+            if (pthread_equal(marks[j].thread, marks[i].thread))
+            {
+                from = &marks[j].at;
+                break;
+            }
+
+        fprintf(stderr, "%22.3f %7.3f  %s\n", elapsedMs(&start, &marks[i].at), elapsedMs(from, &marks[i].at),
+                marks[i].phase);
+    }
+
+    pthread_mutex_unlock(&mutex);
+}
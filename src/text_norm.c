@@ -0,0 +1,137 @@
+#include <text_norm.h>
+#include <utf8.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Local functions */
+
+/*
+ * Copies a block of 16 printable ASCII bytes that needs no changes. Returns 1 if the block was copied or 0 if it
+ * has to go through the byte by byte path.
+ */
+static int asciiBlock(char *dst, size_t *out, const char *src);
+
+static int asciiBlock(char *dst, size_t *out, const char *src)
+{
+#ifdef __SSE2__
+    __m128i b = _mm_loadu_si128((const __m128i *)src);
+
+    /* Bytes after 0x7f are negative as signed chars, so they fail the first comparison too. */
+    __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(b, _mm_set1_epi8(0x1f)), _mm_cmplt_epi8(b, _mm_set1_epi8(0x7f)));
+    if (_mm_movemask_epi8(printable) != 0xffff)
+        return 0;
+
+    unsigned int spaces = _mm_movemask_epi8(_mm_cmpeq_epi8(b, _mm_set1_epi8(' ')));
+#else
+    unsigned int spaces = 0;
+
+    for (int i = 0; i < TEXT_BLOCK; i++)
+    {
+        if (src[i] < 0x20 || src[i] == 0x7f)
+            return 0;
+
+        if (src[i] == ' ')
+            spaces |= 1u << i;
+    }
+#endif
+
+    /* Runs of spaces are collapsed and lines don't start with spaces, the byte by byte path takes care of both. */
+    if ((spaces & (spaces >> 1)) || ((spaces & 1) && (!*out || dst[*out - 1] == ' ' || dst[*out - 1] == '\n')))
+        return 0;
+
+#ifdef __SSE2__
+    _mm_storeu_si128((__m128i *)&dst[*out], b);
+#else
+    memmove(&dst[*out], src, TEXT_BLOCK);
+#endif
+    *out += TEXT_BLOCK;
+
+    return 1;
+}
+
+size_t textNormalize(char *dst, const char *src, size_t len)
+{
+    size_t out = 0;
+    size_t i = 0;
+
+    while (i < len)
+    {
+        if (i + TEXT_BLOCK <= len && asciiBlock(dst, &out, &src[i]))
+        {
+            i += TEXT_BLOCK;
+            continue;
+        }
+
+        unsigned char c = src[i];
+
+        if (c >= 0x80)
+        {
+            unsigned int cp;
+            int n = utf8Decode((const unsigned char *)&src[i], len - i, &cp);
+
+            if (n == 0)
+            {
+                /* A byte that isn't part of a valid sequence is replaced, so the text can still be typed. */
+                dst[out++] = '?';
+                i++;
+            }
+            else if (cp == 0xa0)
+            {
+                /* A no-break space is typed as a space. */
+                if (out && dst[out - 1] != ' ' && dst[out - 1] != '\n')
+                    dst[out++] = ' ';
+                i += n;
+            }
+            else if (cp < 0xa0)
+            {
+                /* C1 control characters are dropped like the C0 ones. */
+                i += n;
+            }
+            else
+            {
+                memmove(&dst[out], &src[i], n);
+                out += n;
+                i += n;
+            }
+            continue;
+        }
+
+        i++;
+
+        if (c == '\r')
+        {
+            /* The LF of a CRLF pair is written when it's reached. */
+            if (i < len && src[i] == '\n')
+                continue;
+
+            c = '\n';
+        }
+
+        if (c == '\t')
+            c = ' ';
+
+        if (c == ' ')
+        {
+            if (out && dst[out - 1] != ' ' && dst[out - 1] != '\n')
+                dst[out++] = ' ';
+        }
+        else if (c == '\n')
+        {
+            /* No spaces at the end of a line, no blank lines at the start and at most one blank line in a row. */
+            while (out && dst[out - 1] == ' ')
+                out--;
+
+            if (out && (out < 2 || dst[out - 1] != '\n' || dst[out - 2] != '\n'))
+                dst[out++] = '\n';
+        }
+        else if (c >= ' ' && c != 127)
+        {
+            dst[out++] = c;
+        }
+    }
+
+    return out;
+}
@@ -0,0 +1,85 @@
+#include <typing_core.h>
+
+/* Local functions */
+
+/*
+ * Returns 1 if the n bytes of key are the next ones of the text.
+ */
+static int sessionMatch(const tSession *s, const char *key, int n);
+
+static int sessionMatch(const tSession *s, const char *key, int n)
+{
+    if (n > s->len - s->idx)
+        return 0;
+
+    /* Nearly every key is a single byte, so that case doesn't go through memcmp. */
+    if (n == 1)
+        return key[0] == s->text[s->idx];
+
+    return memcmp(key, &s->text[s->idx], n) == 0;
+}
+
+void sessionInit(tSession *s, const char *text, int len, tKeyLog *log)
+{
+    s->text = text;
+    s->len = len;
+    s->log = log;
+    sessionReset(s);
+}
+
+void sessionReset(tSession *s)
+{
+    s->idx = 0;
+    s->mistakes = 0;
+    s->started = 0;
+    speedStart(&s->speed, 0);
+
+    if (s->log)
+        keyLogReset(s->log);
+}
+
+void sessionNext(tSession *s, const char *text, int len)
+{
+    s->text = text;
+    s->len = len;
+    s->idx = 0;
+}
+
+int sessionKey(tSession *s, const char *key, int n, long long now)
+{
+    if (s->idx >= s->len)
+        return CORE_IGNORED;
+
+    if (!s->started)
+    {
+        if (!sessionMatch(s, key, n))
+            return CORE_IGNORED;
+
+        speedStart(&s->speed, now);
+        s->started = 1;
+    }
+    else if (!sessionMatch(s, key, n))
+    {
+        s->mistakes++;
+        if (s->log)
+            keyLogMiss(s->log, s->text[s->idx - 1], s->text[s->idx]);
+
+        return CORE_MISTAKE;
+    }
+    else
+    {
+        if (s->log)
+            keyLogKey(s->log, s->text[s->idx - 1], s->text[s->idx], now - s->speed.last);
+
+        speedKey(&s->speed, now);
+    }
+
+    s->idx += n;
+
+    return s->idx == s->len ? CORE_FINISH : CORE_MATCH;
+}
+
+int sessionDone(const tSession *s)
+{
+    return s->idx >= s->len;
+}
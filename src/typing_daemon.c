@@ -0,0 +1,605 @@
+#include <typing_daemon.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+
+/* Local variables */
+/* Set by SIGINT and SIGTERM, the event loop stops when it sees it. */
+static volatile sig_atomic_t stop = 0;
+/* What every client types, and the name its results are saved with. */
+static char *daemon_text;
+static char *daemon_name;
+static tCorpus *daemon_corpus;
+static int daemon_length;
+static int next_id = 1;
+
+/* Queue of the results the writer thread saves to the database. */
+static tResult *results_head = NULL;
+static tResult *results_tail = NULL;
+static int writer_run = 1;
+static pthread_mutex_t results_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t results_cond = PTHREAD_COND_INITIALIZER;
+
+/* Local functions */
+
+/*
+ * Signal handler for SIGINT and SIGTERM.
+ */
+static void stopDaemon(int sig);
+
+/*
+ * The only thread that uses the database, it saves the queued results in the order they finished. Once the daemon
+ * stops it saves what is left in the queue and returns.
+ */
+static void *writerThread(void *arg);
+
+/*
+ * Queues the result of the finished session of c for the writer thread.
+ */
+static void queueResult(tClient *c);
+
+/*
+ * Accepts every pending connection of the listening socket lfd and registers it in the epoll instance ep.
+ */
+static void acceptClients(int lfd, int ep);
+
+/*
+ * Starts a new test for c, with a new passage when the text comes from a corpus. Returns 0 or -1 if there is no
+ * passage to give, the client has to leave then.
+ */
+static int clientStart(tClient *c);
+
+/*
+ * Splits the text of c in screen lines the same way dumpRows() does.
+ */
+static void clientWrap(tClient *c);
+
+/*
+ * Reads what c sent and feeds it to its session. Returns -1 if the client left.
+ */
+static int clientInput(tClient *c);
+
+/*
+ * Handles the n bytes of a single key. Returns -1 if the key asks to leave.
+ */
+static int clientKey(tClient *c, const char *key, int n, long long now);
+
+/*
+ * Rebuilds the rows of the terminal state of c from its session.
+ */
+static void clientDraw(tClient *c);
+
+/*
+ * Draws c if it changed and writes the frame, asking epoll to tell when the socket takes more if it's full.
+ */
+static int clientRender(tClient *c, int ep);
+
+/*
+ * Closes the connection of c and frees it.
+ */
+static void clientClose(tClient *c);
+
+static void stopDaemon(int sig)
+{
+    stop = sig;
+}
+
+static void *writerThread(void *arg)
+{
+    pthread_mutex_lock(&results_mutex);
+    while (writer_run || results_head)
+    {
+        if (!results_head)
+        {
+            pthread_cond_wait(&results_cond, &results_mutex);
+            continue;
+        }
+
+        tResult *r = results_head;
+        results_head = r->next;
+        if (!results_head)
+            results_tail = NULL;
+
+        /* The event loop only needs the lock to queue, the database is used without it. */
+        pthread_mutex_unlock(&results_mutex);
+
+        insert(daemon_name, r->length, r->mistakes, r->time);
+        save_key_stats(&r->log);
+        keyLogFree(&r->log);
+        free(r);
+
+        pthread_mutex_lock(&results_mutex);
+    }
+    pthread_mutex_unlock(&results_mutex);
+
+    return NULL;
+}
+
+static void queueResult(tClient *c)
+{
+    tResult *r = (tResult *)malloc(sizeof(tResult));
+
+    if (r == 0)
+        pexit("queueResult");
+
+    r->length = c->session.len;
+    r->mistakes = c->session.mistakes;
+    r->time = speedElapsed(&c->session.speed) / 1000000.0;
+    r->next = NULL;
+
+    /* The log goes with the result, the client starts a new one. */
+    r->log = c->log;
+    c->log.ev = NULL;
+    c->log.n = c->log.cap = 0;
+
+    pthread_mutex_lock(&results_mutex);
+    if (results_tail)
+        results_tail->next = r;
+    else
+        results_head = r;
+    results_tail = r;
+    pthread_cond_signal(&results_cond);
+    pthread_mutex_unlock(&results_mutex);
+}
+
+static void clientWrap(tClient *c)
+{
+    int len = c->session.len;
+    int width = 0;
+    int cap = 16;
+
+    free(c->lines);
+    c->lines = (int *)malloc(sizeof(int) * cap);
+    c->nlines = 0;
+
+    if (c->lines == 0)
+        pexit("clientWrap");
+
+    c->lines[c->nlines++] = 0;
+    for (int idx = 0; idx < len;)
+    {
+        int n = 1;
+        int w = 1;
+
+        if ((unsigned char)c->text[idx] >= 0x80 || (idx + 1 < len && (unsigned char)c->text[idx + 1] >= 0x80))
+        {
+            unsigned int cp;
+            n = utf8Cluster(&c->text[idx], len - idx, &w, &cp);
+        }
+
+        idx += n;
+        width += w;
+
+        if (c->text[idx - 1] == '\n' || width >= c->term.screencols - 1 || idx == len)
+        {
+            if (c->nlines == cap)
+            {
+                cap *= 2;
+                c->lines = (int *)realloc(c->lines, sizeof(int) * cap);
+
+                if (c->lines == 0)
+                    pexit("clientWrap");
+            }
+
+            c->lines[c->nlines++] = idx;
+            width = 0;
+        }
+    }
+
+    /* nlines counts the lines, not their starts. */
+    c->nlines--;
+    c->line = 0;
+    while (c->line < c->nlines - 1 && c->lines[c->line + 1] <= c->session.idx)
+        c->line++;
+}
+
+static int clientStart(tClient *c)
+{
+    if (daemon_corpus)
+    {
+        if (c->ownText)
+            free(c->text);
+
+        c->text = corpusPassage(daemon_corpus, daemon_length, ((uint64_t)rand() << 31) ^ rand());
+        c->ownText = 1;
+
+        if (c->text == NULL)
+            return -1;
+    }
+    else
+    {
+        c->text = daemon_text;
+        c->ownText = 0;
+    }
+
+    sessionInit(&c->session, c->text, strlen(c->text), &c->log);
+    c->finished = 0;
+    c->dirty = 1;
+    clientWrap(c);
+
+    return 0;
+}
+
+static void acceptClients(int lfd, int ep)
+{
+    int fd;
+
+    while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        tClient *c = (tClient *)calloc(1, sizeof(tClient));
+        tGrid grid = GRID_INIT;
+
+        if (c == 0)
+            pexit("acceptClients");
+
+        c->fd = fd;
+        c->id = next_id++;
+        c->grid = grid;
+        c->grid.nonblock = 1;
+        c->term.screenrows = DAEMON_ROWS - 2;
+        c->term.screencols = DAEMON_COLS;
+
+        /*
+         * Clear the screen and ask the terminal where the bottom right corner is, the answer gives its size. A new
+         * socket takes it at once, a client that doesn't would never get its size so it's closed.
+         */
+        const char *hello = "\x1b[H\x1b[2J\x1b[999C\x1b[999B\x1b[6n";
+        ssize_t hellolen = strlen(hello);
+
+        struct epoll_event ev = {EPOLLIN, {.ptr = c}};
+        if (clientStart(c) || write(fd, hello, hellolen) != hellolen || epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) == -1)
+        {
+            clientClose(c);
+            continue;
+        }
+    }
+}
+
+static int clientKey(tClient *c, const char *key, int n, long long now)
+{
+    char enter = '\n';
+
+    if (key[0] == CTRL_KEY('q') || key[0] == CTRL_KEY('c'))
+        return -1;
+
+    c->dirty = 1;
+    if (key[0] == '\r')
+        key = &enter;
+
+    if (c->finished)
+    {
+        if (key[0] == '\n')
+            return clientStart(c);
+
+        return 0;
+    }
+
+    if (key[0] == CTRL_KEY('r'))
+    {
+        sessionReset(&c->session);
+        c->line = 0;
+        return 0;
+    }
+
+    if (sessionKey(&c->session, key, n, now) == CORE_FINISH)
+    {
+        c->finished = 1;
+        queueResult(c);
+    }
+
+    while (c->line < c->nlines - 1 && c->lines[c->line + 1] <= c->session.idx)
+        c->line++;
+
+    return 0;
+}
+
+static int clientInput(tClient *c)
+{
+    ssize_t got = read(c->fd, &c->in[c->inlen], sizeof(c->in) - c->inlen);
+
+    if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR))
+        return -1;
+
+    if (got < 0)
+        return 0;
+
+    c->inlen += got;
+    long long now = speedNow();
+    int i = 0;
+
+    while (i < c->inlen)
+    {
+        int n;
+
+        if (c->in[i] == '\x1b')
+        {
+            if (i + 1 == c->inlen)
+                break;
+
+            /* Keys like HOME may come as ESC O and a letter, they are ignored like every other sequence. */
+            if (c->in[i + 1] == 'O')
+            {
+                if (i + 2 == c->inlen)
+                    break;
+
+                i += 3;
+                continue;
+            }
+
+            if (c->in[i + 1] != '[')
+            {
+                i++;
+                continue;
+            }
+
+            /* Find the final byte of the sequence, it may not be here yet. */
+            n = 2;
+            while (i + n < c->inlen && !(c->in[i + n] >= 0x40 && c->in[i + n] <= 0x7e))
+                n++;
+
+            if (i + n == c->inlen)
+            {
+                if (c->inlen < (int)sizeof(c->in))
+                    break;
+
+                /* Nobody sends a sequence this long, drop it. */
+                i = c->inlen;
+                break;
+            }
+
+            int rows, cols;
+            if (c->in[i + n] == 'R' && sscanf(&c->in[i + 2], "%d;%d", &rows, &cols) == 2 && rows > 2 && cols > 2 &&
+                    rows <= DAEMON_MAX_SIZE && cols <= DAEMON_MAX_SIZE)
+            {
+                c->term.screenrows = rows - 2;
+                c->term.screencols = cols;
+                clientWrap(c);
+                c->dirty = 1;
+            }
+
+            i += n + 1;
+            continue;
+        }
+
+        n = utf8Length(c->in[i]);
+        if (i + n > c->inlen)
+            break;
+
+        if (clientKey(c, &c->in[i], n, now))
+            return -1;
+
+        i += n;
+    }
+
+    memmove(c->in, &c->in[i], c->inlen - i);
+    c->inlen -= i;
+
+    return 0;
+}
+
+static void clientDraw(tClient *c)
+{
+    termAttributes *T = &c->term;
+    tSession *s = &c->session;
+    char *message = 0;
+    int len;
+
+    termFreeRows(T);
+
+    len = asprintf(&message, "Session %d: type the text below, Ctrl-R starts over and Ctrl-Q leaves.", c->id);
+    termAppendRow(T, message, len);
+    free(message);
+    termAppendRow(T, "##################################################", 50);
+
+    /* The line being typed and the ones after it, without the newline at their end. */
+    for (int l = c->line; l < c->line + DAEMON_TEXT_ROWS && l < c->nlines; l++)
+    {
+        int end = c->lines[l + 1];
+        if (end > c->lines[l] && c->text[end - 1] == '\n')
+            end--;
+
+        termAppendRow(T, &c->text[c->lines[l]], end - c->lines[l]);
+    }
+
+    while (T->numrows < DAEMON_TEXT_ROWS + 2)
+        termAppendRow(T, "", 0);
+
+    termAppendRow(T, "**************************************************", 50);
+    termAppendRow(T, "", 0);
+
+    /* The typed part of the current line, the cursor is left after it. */
+    int start = c->lines[c->line];
+    int typed = s->idx - start;
+    if (typed > 0 && c->text[s->idx - 1] == '\n')
+        typed--;
+
+    termAppendRow(T, &c->text[start], typed);
+    T->cy = T->numrows - 1;
+    T->cx = typed;
+    T->rx = T->row[T->cy].width;
+
+    long cpm = speedCumulative(&s->speed);
+    if (c->finished)
+    {
+        long long elapsed = speedElapsed(&s->speed);
+        char *lines[4];
+
+        termAppendRow(T, "", 0);
+        asprintf(&lines[0], "Your CPM was %ld.%02ld", cpm / 100, cpm % 100);
+        asprintf(&lines[1], "You finished in %lld.%06lld seconds", elapsed / 1000000, elapsed % 1000000);
+        asprintf(&lines[2], "You made %d mistakes", s->mistakes);
+        asprintf(&lines[3], "Press Enter to take another test.");
+
+        for (int j = 0; j < 4; j++)
+        {
+            termAppendRow(T, lines[j], strlen(lines[j]));
+            free(lines[j]);
+        }
+
+        T->cy = T->numrows - 1;
+        T->cx = T->rx = T->row[T->cy].size;
+    }
+
+    if (!s->started || s->speed.keys < 2)
+    {
+        termSetMessage(T, "\x1b[37mWhen you start typing this will line will show your CPM");
+    }
+    else
+    {
+        long now = speedInstant(&s->speed);
+        termSetMessage(T, "\x1b[%dmYour current CPM is : %ld.%02ld (average %ld.%02ld)",
+                speedColor(speedEwma(&s->speed)), now / 100, now % 100, cpm / 100, cpm % 100);
+    }
+
+    /* Keep the cursor row on the screen. */
+    T->rowoff = T->cy >= T->screenrows ? T->cy - T->screenrows + 1 : 0;
+}
+
+static int clientRender(tClient *c, int ep)
+{
+    if (c->grid.pendlen)
+        return 0;
+
+    if (c->dirty)
+    {
+        clientDraw(c);
+        c->dirty = 0;
+
+        if (gridRender(&c->grid, &c->term, c->fd) < 0)
+            return -1;
+    }
+
+    /* Only ask for EPOLLOUT while a frame is waiting, otherwise it would fire all the time. */
+    if (c->grid.pendlen)
+    {
+        struct epoll_event ev = {EPOLLIN | EPOLLOUT, {.ptr = c}};
+        epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+    }
+
+    return 0;
+}
+
+static void clientClose(tClient *c)
+{
+    write(c->fd, "\x1b[H\x1b[2J", 7);
+    close(c->fd);
+
+    termFreeRows(&c->term);
+    free(c->term.row);
+    gridFree(&c->grid);
+    keyLogFree(&c->log);
+    free(c->lines);
+
+    if (c->ownText)
+        free(c->text);
+
+    free(c);
+}
+
+int daemonRun(const char *path, char *testName, char *text, tCorpus *corpus, int length)
+{
+    struct sockaddr_un addr = {0};
+    struct epoll_event events[DAEMON_EVENTS];
+    pthread_t writer;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "The socket path %s is too long\n", path);
+        return -1;
+    }
+
+    daemon_text = text;
+    daemon_name = testName;
+    daemon_corpus = corpus;
+    daemon_length = length;
+    srand(time(NULL) ^ getpid());
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if (lfd == -1 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(lfd, SOMAXCONN) == -1)
+    {
+        perror("daemonRun");
+        return -1;
+    }
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event lev = {EPOLLIN, {.ptr = NULL}};
+
+    if (ep == -1 || epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &lev) == -1)
+    {
+        perror("daemonRun");
+        close(lfd);
+        unlink(path);
+        return -1;
+    }
+
+    /* A client that leaves while its frame is written must not kill the daemon. */
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stopDaemon);
+    signal(SIGTERM, stopDaemon);
+
+    pthread_create(&writer, NULL, writerThread, NULL);
+    printf("Serving typing tests on %s, stop with Ctrl-C\n", path);
+    fflush(stdout);
+
+    while (!stop)
+    {
+        int n = epoll_wait(ep, events, DAEMON_EVENTS, -1);
+
+        for (int i = 0; i < n; i++)
+        {
+            tClient *c = (tClient *)events[i].data.ptr;
+
+            if (c == NULL)
+            {
+                acceptClients(lfd, ep);
+                continue;
+            }
+
+            if (events[i].events & EPOLLOUT)
+            {
+                int left = gridDrain(&c->grid, c->fd);
+
+                if (left == 0)
+                {
+                    struct epoll_event ev = {EPOLLIN, {.ptr = c}};
+                    epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+                }
+                else if (left < 0)
+                {
+                    clientClose(c);
+                    continue;
+                }
+            }
+
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && clientInput(c))
+            {
+                clientClose(c);
+                continue;
+            }
+
+            if (clientRender(c, ep))
+                clientClose(c);
+        }
+    }
+
+    /*
+     * The clients are found through epoll only, so the ones still connected are closed by the kernel on exit. What
+     * matters is that every finished test gets saved.
+     */
+    pthread_mutex_lock(&results_mutex);
+    writer_run = 0;
+    pthread_cond_signal(&results_cond);
+    pthread_mutex_unlock(&results_mutex);
+    pthread_join(writer, NULL);
+
+    close(ep);
+    close(lfd);
+    unlink(path);
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+#define _GNU_SOURCE // wcwidth needs it
+
+#include <utf8.h>
+#include <wchar.h>
+#include <locale.h>
+#include <langinfo.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Local variables */
+/*
+ * Columns of every code point of the basic plane plus 2, 0 means it wasn't looked up yet. Every thread that draws
+ * fills it, a racing lookup only stores the same value twice so relaxed accesses are enough.
+ */
+static _Atomic unsigned char widthCache[0x10000];
+
+/* Zero width joiner, the code point after it belongs to the same cluster. */
+#define ZWJ 0x200d
+
+void utf8Init(void)
+{
+    setlocale(LC_CTYPE, "");
+
+    if (strcmp(nl_langinfo(CODESET), "UTF-8") != 0)
+        setlocale(LC_CTYPE, "C.UTF-8");
+}
+
+int utf8Length(unsigned char lead)
+{
+    if (lead >= 0xc2 && lead <= 0xdf)
+        return 2;
+    if (lead >= 0xe0 && lead <= 0xef)
+        return 3;
+    if (lead >= 0xf0 && lead <= 0xf4)
+        return 4;
+
+    return 1;
+}
+
+int utf8Decode(const unsigned char *s, size_t left, unsigned int *cp)
+{
+    static const unsigned int min[5] = {0, 0, 0x80, 0x800, 0x10000};
+    static const unsigned char mask[5] = {0, 0x7f, 0x1f, 0x0f, 0x07};
+
+    if (left == 0)
+        return 0;
+
+    if (s[0] < 0x80)
+    {
+        *cp = s[0];
+        return 1;
+    }
+
+    int len = utf8Length(s[0]);
+    if (len == 1 || (size_t)len > left)
+        return 0;
+
+    *cp = s[0] & mask[len];
+    for (int i = 1; i < len; i++)
+    {
+        if ((s[i] & 0xc0) != 0x80)
+            return 0;
+
+        *cp = (*cp << 6) | (s[i] & 0x3f);
+    }
+
+    if (*cp < min[len] || (*cp >= 0xd800 && *cp <= 0xdfff) || *cp > 0x10ffff)
+        return 0;
+
+    return len;
+}
+
+int utf8Width(unsigned int cp)
+{
+    if (cp < 0x300)
+        return 1;
+
+    if (cp < 0x10000)
+    {
+        int cached = atomic_load_explicit(&widthCache[cp], memory_order_relaxed);
+        if (cached)
+            return cached - 2;
+    }
+
+    /* Code points the C library can't print are shown as a single replacement cell. */
+    int w = wcwidth((wchar_t)cp);
+    if (w < 0)
+        w = 1;
+    if (w > 2)
+        w = 2;
+
+    if (cp < 0x10000)
+        atomic_store_explicit(&widthCache[cp], w + 2, memory_order_relaxed);
+
+    return w;
+}
+
+int utf8Cluster(const char *s, size_t left, int *width, unsigned int *cp)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    int len = utf8Decode(u, left, cp);
+
+    if (len == 0)
+    {
+        *cp = UTF8_INVALID;
+        *width = 1;
+        return 1;
+    }
+
+    /* Control characters never take marks, and plain ASCII followed by ASCII is the common case. */
+    if (*cp < 0xa0 && (*cp < 0x20 || *cp >= 0x7f || (size_t)len == left || u[len] < 0x80))
+    {
+        *width = 1;
+        return len;
+    }
+
+    *width = utf8Width(*cp);
+    if (*width == 0)
+        *width = 1;
+
+    int joined = 0;
+    while ((size_t)len < left)
+    {
+        unsigned int next;
+        int n = utf8Decode(&u[len], left - len, &next);
+
+        if (n == 0 || len + n > UTF8_CLUSTER_MAX || next < 0x300 || (!joined && utf8Width(next) != 0))
+            break;
+
+        joined = next == ZWJ;
+        len += n;
+    }
+
+    return len;
+}
+
+int utf8IsAscii(const char *s, size_t len)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128i any = _mm_setzero_si128();
+
+    for (; i + 16 <= len; i += 16)
+        any = _mm_or_si128(any, _mm_loadu_si128((const __m128i *)&s[i]));
+
+    if (_mm_movemask_epi8(any))
+        return 0;
+#else
+    uint64_t any = 0;
+
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, &s[i], 8);
+        any |= w;
+    }
+
+    if (any & 0x8080808080808080ULL)
+        return 0;
+#endif
+
+    for (; i < len; i++)
+        if ((unsigned char)s[i] >= 0x80)
+            return 0;
+
+    return 1;
+}
@@ -0,0 +1,40 @@
+#include <typing_core.h>
+#include <stdio.h>
+
+/*
+ * Links against libtypingcore.a alone, every object of it included, so the build fails if the typing engine calls
+ * anything of the terminal or the database. It then types a short text with a mistake and checks what the session
+ * and the key log tell.
+ */
+
+/* Defines */
+
+#define CHECK_TEXT "qwqw"
+/* Microseconds between two keys. */
+#define CHECK_PACE_US 100000
+
+int main(void)
+{
+    static const char keys[] = "qwxqw";
+    tKeyLog log = KEYLOG_INIT;
+    tSession s;
+    long long now = 0;
+
+    sessionInit(&s, CHECK_TEXT, sizeof(CHECK_TEXT) - 1, &log);
+
+    for (int i = 0; keys[i]; i++)
+        sessionKey(&s, &keys[i], 1, now += CHECK_PACE_US);
+
+    /* 3 bigrams typed right and 1 missed, and the totals of the 2 keys after them. */
+    int ok = sessionDone(&s) && s.mistakes == 1 && log.n == 4 && keyLogCompact(&log) == 0 && log.n == 4;
+
+    keyLogFree(&log);
+
+    if (!ok)
+    {
+        fprintf(stderr, "The typing engine doesn't type " CHECK_TEXT " right\n");
+        return 1;
+    }
+
+    return 0;
+}
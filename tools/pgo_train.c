@@ -0,0 +1,357 @@
+#define _GNU_SOURCE // ppoll
+
+#include <pty.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*
+ * Plays a scripted typing session on 2fingers through a pseudo terminal, without a human: auto tests, custom tests
+ * of a passage with mistakes, and every view of the database menu. It's the workload the release build is trained
+ * on, and it prints the CPU time the program used per key it was sent.
+ */
+
+/* Defines */
+
+/* Rounds played when no number is given, each one sends about 540 keys. */
+#define TRAIN_ROUNDS 10
+/* Microseconds between two keys, the program handles each of them before the next one comes. */
+#define TRAIN_PACE_US 2000
+/* Size of the pseudo terminal. */
+#define TRAIN_ROWS 40
+#define TRAIN_COLS 120
+/* Seconds to wait for the menu to show up, and for the program to exit at the end. */
+#define TRAIN_TIMEOUT 10
+/* Length of the auto test, the one the program uses when it isn't given any. */
+#define TRAIN_TEST_LENGTH 100
+/* A wrong key comes before every TRAIN_MISTAKE_EVERY-th key of the tests. */
+#define TRAIN_MISTAKE_EVERY 25
+
+#define KEY_PAGE_DOWN "\x1b[6~"
+#define KEY_PAGE_UP "\x1b[5~"
+
+/* Type definitios */
+
+/*
+ * The program being trained and what was sent to it.
+ */
+typedef struct tTrainer
+{
+    int fd;
+    pid_t pid;
+    long keys;
+    /* The last output read, to look for text in it. */
+    char seen[4096];
+    size_t nseen;
+} tTrainer;
+
+/* Local functions */
+
+/*
+ * Reads and drops the output of the program for us microseconds, keeping its end in t->seen. Returns -1 once the
+ * program closed the terminal.
+ */
+static int drain(tTrainer *t, long us);
+
+/*
+ * Waits up to seconds for text to be in the output. Returns 0 or 1 if it never showed up.
+ */
+static int waitFor(tTrainer *t, const char *text, int seconds);
+
+/*
+ * Sends the key made of the bytes of seq, and gives the program TRAIN_PACE_US to handle it.
+ */
+static void sendKey(tTrainer *t, const char *seq);
+
+/*
+ * Types text one character at a time, a line ending is typed with Enter. A wrong key comes before one key out of
+ * TRAIN_MISTAKE_EVERY.
+ */
+static void typeText(tTrainer *t, const char *text);
+
+/*
+ * Plays a round: an auto test, a custom test and a tour of the database menu.
+ */
+static void playRound(tTrainer *t);
+
+/* Static variables */
+
+/* The custom test, whole lines without spaces around them like the program keeps them, and a few accents. */
+static const char *passage =
+    "The quick brown fox jumps over the lazy dog, then it naps in the sun.\n"
+    "Pack my box with five dozen liquor jugs before the café closes at ten.\n"
+    "A naïve typist looks at the keys; a trained one keeps an eye on the text.\n"
+    "Sphinx of black quartz, judge my vow: 12 + 30 = 42 (more or less).\n"
+    "Déjà vu is typing the same line twice and making the same mistakes.";
+
+static int drain(tTrainer *t, long us)
+{
+    struct timespec end, now;
+    char buf[4096];
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += us / 1000000;
+    end.tv_nsec += us % 1000000 * 1000;
+    if (end.tv_nsec >= 1000000000)
+    {
+        end.tv_sec++;
+        end.tv_nsec -= 1000000000;
+    }
+
+    for (;;)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        struct timespec left = {end.tv_sec - now.tv_sec, end.tv_nsec - now.tv_nsec};
+        if (left.tv_nsec < 0)
+        {
+            left.tv_sec--;
+            left.tv_nsec += 1000000000;
+        }
+        if (left.tv_sec < 0)
+            return 0;
+
+        struct pollfd pfd = {t->fd, POLLIN, 0};
+        int rc = ppoll(&pfd, 1, &left, NULL);
+
+        if (rc < 0 && errno != EINTR)
+            return -1;
+        if (rc <= 0)
+            continue;
+
+        ssize_t n = read(t->fd, buf, sizeof(buf));
+        if (n <= 0)
+            return -1;
+
+        /* The program finds the size of the screen from the cursor at the bottom right, it's answered like a terminal. */
+        if (memmem(buf, n, "\x1b[6n", 4))
+        {
+            char pos[32];
+            int len = snprintf(pos, sizeof(pos), "\x1b[%d;%dR", TRAIN_ROWS, TRAIN_COLS);
+            if (write(t->fd, pos, len) == -1)
+                return -1;
+        }
+
+        /* Only the end of the output is kept, enough for the text looked for. */
+        size_t half = (sizeof(t->seen) - 1) / 2;
+        char *s = buf;
+        if ((size_t)n > half)
+        {
+            s += n - half;
+            n = half;
+        }
+        if (t->nseen + n >= sizeof(t->seen))
+        {
+            memmove(t->seen, t->seen + t->nseen - half, half);
+            t->nseen = half;
+        }
+
+        memcpy(t->seen + t->nseen, s, n);
+        t->nseen += n;
+        t->seen[t->nseen] = '\0';
+    }
+}
+
+static int waitFor(tTrainer *t, const char *text, int seconds)
+{
+    for (int i = 0; i < seconds * 10; i++)
+    {
+        if (memmem(t->seen, t->nseen, text, strlen(text)))
+            return 0;
+        if (drain(t, 100000) == -1)
+            return 1;
+    }
+
+    return 1;
+}
+
+static void sendKey(tTrainer *t, const char *seq)
+{
+    if (write(t->fd, seq, strlen(seq)) == -1)
+    {
+        perror("write");
+        exit(1);
+    }
+
+    t->keys++;
+    drain(t, TRAIN_PACE_US);
+}
+
+static void typeText(tTrainer *t, const char *text)
+{
+    char key[5];
+
+    for (int i = 1; *text; i++)
+    {
+        /* A character is a key, whatever the number of bytes it takes in UTF-8. */
+        int n = 1;
+        while (n < 4 && ((unsigned char)text[n] & 0xc0) == 0x80)
+            n++;
+
+        if (i % TRAIN_MISTAKE_EVERY == 0)
+            sendKey(t, "#");
+
+        if (*text == '\n')
+            strcpy(key, "\r");
+        else
+        {
+            memcpy(key, text, n);
+            key[n] = '\0';
+        }
+
+        sendKey(t, key);
+        text += n;
+    }
+}
+
+static void playRound(tTrainer *t)
+{
+    /* The auto test of the q and w keys, the one it starts with is the first of the test. */
+    char qw[TRAIN_TEST_LENGTH + 2];
+    for (int i = 0; i <= TRAIN_TEST_LENGTH; i++)
+        qw[i] = "qw"[i % 2];
+    qw[TRAIN_TEST_LENGTH + 1] = '\0';
+
+    sendKey(t, "\t");
+    typeText(t, qw);
+    sendKey(t, "n");
+
+    sendKey(t, "c");
+    typeText(t, passage);
+    sendKey(t, "n");
+
+    /* Every view of the database menu, answering the questions they ask. */
+    static const char *menu[] = {
+        "b",
+        "1", "t", "r", "a", "i", "n", "\r", "\r", KEY_PAGE_DOWN, KEY_PAGE_DOWN, KEY_PAGE_UP, "\r",
+        "1", "q", "w", "\r", "5", "0", "\r", KEY_PAGE_DOWN, "\r",
+        "2", "t", "r", "a", "i", "n", "\r", "n", "\r",
+        "2", "q", "w", "\r", "y", "\r",
+        "3", "\r",
+        "4", "\r",
+        "5", "t", "r", "a", "i", "n", "\r", "\r",
+        "6", "t", "r", "a", "i", "n", "\r", "d", "\r",
+        "6", "q", "w", "\r", "w", "\r",
+        "x",
+    };
+
+    for (int i = 0; i < (int)(sizeof(menu) / sizeof(menu[0])); i++)
+        sendKey(t, menu[i]);
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = argc == 3 ? atoi(argv[2]) : TRAIN_ROUNDS;
+
+    if ((argc != 2 && argc != 3) || rounds <= 0)
+    {
+        printf("The correct format is: %s <2fingers> [<rounds>]\n", argv[0]);
+        return 1;
+    }
+
+    /* The results go to a database of their own, next to the passage. */
+    char dir[] = "/tmp/2fingers-train-XXXXXX";
+    char *text = 0, *db = 0, *wal = 0, *shm = 0;
+
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    asprintf(&text, "%s/passage.txt", dir);
+    asprintf(&db, "%s/train.db", dir);
+    asprintf(&wal, "%s-wal", db);
+    asprintf(&shm, "%s-shm", db);
+
+    FILE *f = fopen(text, "w");
+    if (f == NULL || fputs(passage, f) == EOF || fclose(f) != 0)
+    {
+        perror(text);
+        return 1;
+    }
+
+    tTrainer t = {0};
+    struct winsize ws = {TRAIN_ROWS, TRAIN_COLS, 0, 0};
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    t.pid = forkpty(&t.fd, NULL, NULL, &ws);
+
+    if (t.pid == -1)
+    {
+        perror("forkpty");
+        return 1;
+    }
+
+    if (t.pid == 0)
+    {
+        execl(argv[1], argv[1], "--db", db, text, "train", (char *)NULL);
+        perror(argv[1]);
+        _exit(127);
+    }
+
+    /* The terminal is put in raw mode before the menu is shown, keys sent earlier would be flushed. */
+    int failed = waitFor(&t, "Type q to quit", TRAIN_TIMEOUT);
+
+    if (failed)
+        fprintf(stderr, "%s didn't show its menu\n", argv[1]);
+    else
+    {
+        for (int i = 0; i < rounds; i++)
+            playRound(&t);
+        sendKey(&t, "q");
+    }
+
+    int status = 0;
+    for (int i = 0; waitpid(t.pid, &status, WNOHANG) == 0; i++)
+    {
+        if (i == TRAIN_TIMEOUT * 10)
+        {
+            fprintf(stderr, "%s didn't exit, killing it\n", argv[1]);
+            kill(t.pid, SIGKILL);
+            failed = 1;
+        }
+        /* Once the terminal is closed there is nothing to read, only the exit to wait for. */
+        if (drain(&t, 100000) == -1)
+            usleep(100000);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close(t.fd);
+
+    unlink(text);
+    unlink(db);
+    unlink(wal);
+    unlink(shm);
+    rmdir(dir);
+    free(text);
+    free(db);
+    free(wal);
+    free(shm);
+
+    if (failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "%s didn't finish the training\n", argv[1]);
+        return 1;
+    }
+
+    /* Every thread of the program counts, the refresh of the screen is part of the cost of a key. */
+    struct rusage ru;
+    getrusage(RUSAGE_CHILDREN, &ru);
+
+    double cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+    double wall = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("%-28s %ld keys in %.2f s, %.3f s of CPU, %.1f us per key\n", argv[1], t.keys, wall, cpu,
+            cpu * 1e6 / t.keys);
+
+    return 0;
+}